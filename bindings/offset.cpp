@@ -132,11 +132,11 @@ _volume (_Regular_triangulation_3 &rt, size_t idx, double R)
 }
 
 
-Covariance_vector
+cloudy::uvector
 _covariance (_Regular_triangulation_3 &rt, size_t idx, double R)
 {
    _Regular_triangulation_3::Vertex_handle v = rt.vertex(idx);   
-   return covariance<Clamp_subdivider>(rt, v, R);
+   return cloudy::linear::to_uvector(covariance<Clamp_subdivider>(rt, v, R));
 }
 
 
@@ -0,0 +1,247 @@
+#ifndef CLOUDY_BOX_TREE_HPP
+#define CLOUDY_BOX_TREE_HPP
+
+#include <cloudy/Cloud.hpp>
+#include <cloudy/KD_tree.hpp>
+#include <algorithm>
+#include <vector>
+#include <math.h>
+
+namespace cloudy
+{
+   // A kd-tree stored in flat arrays, with the bounding box of the
+   // points of every node. Unlike KD_tree (ANN), the nodes are
+   // exposed, so that quantities can be aggregated over them. The
+   // points are permuted so that every node is a contiguous range of
+   // them; the nodes are stored in depth-first order, so that the
+   // children of a node always come after it.
+   class Box_tree
+   {
+      public:
+	 struct Node
+	 {
+	       size_t begin, end;	// range of (permuted) points
+	       size_t left, right;	// children, 0 for a leaf
+	 };
+
+      private:
+	 size_t _dim;
+	 size_t _leaf_size;
+	 std::vector<Node> _nodes;
+	 std::vector<double> _lo, _hi;		// node boxes
+	 std::vector<size_t> _order;		// original index of points
+	 std::vector<double> _coords;		// permuted coordinates
+
+	 struct Compare_coordinate
+	 {
+	       const Box_tree &t;
+	       size_t d;
+	       bool operator () (size_t a, size_t b) const
+	       {
+		  return t._coords[t._dim * a + d] < t._coords[t._dim * b + d];
+	       }
+	 };
+
+	 size_t
+	 _build (size_t begin, size_t end, std::vector<size_t> &perm)
+	 {
+	    size_t id = _nodes.size();
+	    Node node = {begin, end, 0, 0};
+	    _nodes.push_back(node);
+	    _lo.resize(_dim * _nodes.size());
+	    _hi.resize(_dim * _nodes.size());
+
+	    double *lo = &_lo[_dim * id], *hi = &_hi[_dim * id];
+	    for (size_t d = 0; d < _dim; ++d)
+	       lo[d] = hi[d] = _coords[_dim * perm[begin] + d];
+	    for (size_t i = begin + 1; i < end; ++i)
+	       for (size_t d = 0; d < _dim; ++d)
+	       {
+		  double x = _coords[_dim * perm[i] + d];
+		  lo[d] = std::min(lo[d], x);
+		  hi[d] = std::max(hi[d], x);
+	       }
+
+	    if (end - begin <= _leaf_size)
+	       return id;
+
+	    // split at the median of the widest side
+	    size_t split = 0;
+	    for (size_t d = 1; d < _dim; ++d)
+	       if (hi[d] - lo[d] > hi[split] - lo[split])
+		  split = d;
+	    if (hi[split] == lo[split])
+	       return id;
+
+	    size_t mid = (begin + end) / 2;
+	    Compare_coordinate cmp = {*this, split};
+	    std::nth_element(perm.begin() + begin, perm.begin() + mid,
+			     perm.begin() + end, cmp);
+
+	    size_t left = _build(begin, mid, perm);
+	    size_t right = _build(mid, end, perm);
+	    _nodes[id].left = left;
+	    _nodes[id].right = right;
+	    return id;
+	 }
+
+	 template <class Points>
+	 void
+	 _init (const Points &points, size_t N)
+	 {
+	    _coords.resize(_dim * N);
+	    for (size_t i = 0; i < N; ++i)
+	       for (size_t d = 0; d < _dim; ++d)
+		  _coords[_dim * i + d] = points(i, d);
+
+	    std::vector<size_t> perm(N);
+	    for (size_t i = 0; i < N; ++i)
+	       perm[i] = i;
+	    _nodes.clear();
+	    if (N > 0)
+	       _build(0, N, perm);
+
+	    // store the points in tree order
+	    std::vector<double> coords(_dim * N);
+	    for (size_t i = 0; i < N; ++i)
+	       std::copy(&_coords[_dim * perm[i]],
+			 &_coords[_dim * perm[i]] + _dim,
+			 &coords[_dim * i]);
+	    _coords.swap(coords);
+	    _order.swap(perm);
+	 }
+
+	 struct Tree_points
+	 {
+	       const KD_tree &kd;
+	       double operator () (size_t i, size_t d) const
+	       {
+		  return kd.coordinates(i)[d];
+	       }
+	 };
+
+	 struct Cloud_points
+	 {
+	       const Data_cloud &c;
+	       double operator () (size_t i, size_t d) const
+	       {
+		  return c[i][d];
+	       }
+	 };
+
+      public:
+	 Box_tree (const KD_tree &kd, size_t leaf_size = 16) :
+	    _dim(kd.dim()), _leaf_size(std::max(leaf_size, size_t(1)))
+	 {
+	    Tree_points tp = {kd};
+	    _init(tp, kd.size());
+	 }
+
+	 Box_tree (const Data_cloud &c, size_t leaf_size = 16) :
+	    _dim(c.size() ? c[0].size() : 0),
+	    _leaf_size(std::max(leaf_size, size_t(1)))
+	 {
+	    Cloud_points cp = {c};
+	    _init(cp, c.size());
+	 }
+
+	 size_t size() const
+	 {
+	    return _order.size();
+	 }
+
+	 size_t dim() const
+	 {
+	    return _dim;
+	 }
+
+	 size_t num_nodes() const
+	 {
+	    return _nodes.size();
+	 }
+
+	 const Node &
+	 node (size_t n) const
+	 {
+	    return _nodes[n];
+	 }
+
+	 bool
+	 is_leaf (size_t n) const
+	 {
+	    return _nodes[n].left == 0;
+	 }
+
+	 // Original index of the i-th point in tree order
+	 size_t
+	 index (size_t i) const
+	 {
+	    return _order[i];
+	 }
+
+	 // Coordinates of the i-th point in tree order
+	 const double *
+	 point (size_t i) const
+	 {
+	    return &_coords[_dim * i];
+	 }
+
+	 // Corners of the bounding box of node n
+	 const double *
+	 box_lo (size_t n) const
+	 {
+	    return &_lo[_dim * n];
+	 }
+
+	 const double *
+	 box_hi (size_t n) const
+	 {
+	    return &_hi[_dim * n];
+	 }
+
+	 // Smallest and largest squared distances from q to the box of
+	 // node n.
+	 void
+	 box_distances (size_t n, const double *q,
+			double &dmin2, double &dmax2) const
+	 {
+	    const double *lo = &_lo[_dim * n], *hi = &_hi[_dim * n];
+	    dmin2 = dmax2 = 0.0;
+	    for (size_t d = 0; d < _dim; ++d)
+	    {
+	       double a = lo[d] - q[d], b = q[d] - hi[d];
+	       double in = std::max(std::max(a, b), 0.0);
+	       double out = std::max(fabs(a), fabs(b));
+	       dmin2 += in * in;
+	       dmax2 += out * out;
+	    }
+	 }
+
+	 // Sums of a field with C components (stored flat, by original
+	 // index) over the points of every node, computed bottom-up.
+	 void
+	 node_sums (const std::vector<double> &field, size_t C,
+		    std::vector<double> &sums) const
+	 {
+	    sums.assign(C * _nodes.size(), 0.0);
+	    for (size_t n = _nodes.size(); n-- > 0;)
+	    {
+	       double *s = &sums[C * n];
+	       const Node &node = _nodes[n];
+	       if (is_leaf(n))
+	       {
+		  for (size_t i = node.begin; i < node.end; ++i)
+		     for (size_t c = 0; c < C; ++c)
+			s[c] += field[C * _order[i] + c];
+	       }
+	       else
+	       {
+		  for (size_t c = 0; c < C; ++c)
+		     s[c] = sums[C * node.left + c] + sums[C * node.right + c];
+	       }
+	    }
+	 }
+   };
+}
+
+#endif
@@ -3,84 +3,215 @@
 
 #include <cloudy/Cloud.hpp>
 #include <cloudy/KD_tree.hpp>
+#include <cloudy/Grid_index.hpp>
+#include <cloudy/Box_tree.hpp>
+#include <cloudy/Neighbor_graph.hpp>
+#include <algorithm>
+#include <math.h>
 
 namespace cloudy
 {
-   class Tent_function
+   // Radial kernels, as policies for Kernel_function: support() is the
+   // radius of the support in units of the scale r, and eval(q2) is
+   // the kernel at squared distance q2 (in units of r^2), which is
+   // only called within the support. The kernels are not normalized;
+   // they all take the value 1 at the origin. name() identifies the
+   // kernel in cached neighbour graphs.
+   //
+   // For the tree code, slope(q2) and slope2(q2) are the first and
+   // second derivatives of eval, and jerk(a2, b2) bounds the norm of
+   // the third derivative of the kernel, as a function of the point
+   // in space, at squared distances between a2 and b2 <= support()^2.
+   // For a radial kernel K(x), it is at most
+   //   |K'''(x)| + 2/sqrt(3) |K''(x)/x - K'(x)/x^2|.
+
+   struct Uniform_kernel
    {
-	 double _r;
-      public:
-	 Tent_function(double r = 0.0) : _r(r)
-	 {}
+	 static const char *name () { return "uniform"; }
+	 static double support () { return 1.0; }
+	 static double eval (double) { return 1.0; }
+	 static double slope (double) { return 0.0; }
+	 static double slope2 (double) { return 0.0; }
+	 static double jerk (double, double) { return 0.0; }
+   };
 
-	 inline 
-	 double support_radius() const
+   struct Tent_kernel
+   {
+	 static const char *name () { return "tent"; }
+	 static double support () { return 1.0; }
+	 static double eval (double q2) { return 1.0 - sqrt(q2); }
+	 static double slope (double q2) { return -0.5 / sqrt(q2); }
+	 static double slope2 (double q2) { return 0.25 / (q2 * sqrt(q2)); }
+	 // K'' = 0, K' = -1
+	 static double jerk (double a2, double)
 	 {
-	    return _r;
+	    return (a2 > 0.0) ? 2.0 / sqrt(3.0) / a2 : HUGE_VAL;
 	 }
+   };
 
-	 inline
-	 double operator () (const uvector &v) const
+   // quadratic: the tree code is exact
+   struct Epanechnikov_kernel
+   {
+	 static const char *name () { return "epanechnikov"; }
+	 static double support () { return 1.0; }
+	 static double eval (double q2) { return 1.0 - q2; }
+	 static double slope (double) { return -1.0; }
+	 static double slope2 (double) { return 0.0; }
+	 static double jerk (double, double) { return 0.0; }
+   };
+
+   struct Biweight_kernel
+   {
+	 static const char *name () { return "biweight"; }
+	 static double support () { return 1.0; }
+	 static double eval (double q2) { return (1.0 - q2) * (1.0 - q2); }
+	 static double slope (double q2) { return -2.0 * (1.0 - q2); }
+	 static double slope2 (double) { return 2.0; }
+	 // K''' = 24 x, K''/x - K'/x^2 = 8 x
+	 static double jerk (double, double b2)
 	 {
-	    return std::max(1.0 - ublas::norm_2(v)/_r, 0.0);
+	    return (24.0 + 16.0 / sqrt(3.0)) * sqrt(b2);
 	 }
    };
 
-   class Uniform_function
+   // Gaussian of standard deviation r, truncated at 3r
+   struct Gaussian_kernel
    {
-	 double _r;
+	 static const char *name () { return "gaussian"; }
+	 static double support () { return 3.0; }
+	 static double eval (double q2) { return exp(-0.5 * q2); }
+	 static double slope (double q2) { return -0.5 * exp(-0.5 * q2); }
+	 static double slope2 (double q2) { return 0.25 * exp(-0.5 * q2); }
+
+	 // |K'''| = |3x - x^3| exp(-x^2/2) has its maxima at
+	 // x^2 = 3 -+ sqrt(6), and K''/x - K'/x^2 = x exp(-x^2/2) at
+	 // x = 1: each is bounded on [a, b] by its values at a, b and
+	 // at the maxima within [a, b] (rounded up below)
+	 static double jerk (double a2, double b2)
+	 {
+	    static const double third_1 = 1.380120, third_2 = 0.374897;
+	    static const double mixed_peak = 0.606531;
+
+	    const double ma = sqrt(a2) * exp(-0.5 * a2);
+	    const double mb = sqrt(b2) * exp(-0.5 * b2);
+	    double h3 = std::max(fabs(3.0 - a2) * ma, fabs(3.0 - b2) * mb);
+	    if (a2 <= 3.0 - sqrt(6.0) && 3.0 - sqrt(6.0) <= b2)
+	       h3 = std::max(h3, third_1);
+	    if (a2 <= 3.0 + sqrt(6.0) && 3.0 + sqrt(6.0) <= b2)
+	       h3 = std::max(h3, third_2);
+	    const double h = (a2 <= 1.0 && 1.0 <= b2) ? mixed_peak
+	       : std::max(ma, mb);
+	    return h3 + 2.0 / sqrt(3.0) * h;
+	 }
+   };
+
+   // A kernel scaled to radius r. Since the kernel is a template
+   // parameter, its evaluation is inlined in the convolution loops.
+   template <class Kernel>
+   class Kernel_function
+   {
+	 double _r, _inv_r2, _support2;
       public:
-	 Uniform_function(double r) : _r(r)
+	 Kernel_function(double r = 0.0) :
+	    _r(r),
+	    _inv_r2(r > 0.0 ? 1.0/(r * r) : 0.0),
+	    _support2(Kernel::support() * Kernel::support())
 	 {}
 
-	 inline
+	 inline 
 	 double support_radius() const
 	 {
-	    return _r;
+	    return Kernel::support() * _r;
+	 }
+
+	 std::string name() const
+	 {
+	    return Kernel::name();
 	 }
 
 	 inline
 	 double operator () (const uvector &v) const
 	 {
-	    if (ublas::norm_2(v) <= _r)
-	       return 1.0;
-	    else
+	    return (*this)(ublas::inner_prod(v, v));
+	 }
+
+	 // same, given the squared norm of v
+	 inline
+	 double operator () (double squared_distance) const
+	 {
+	    double q2 = squared_distance * _inv_r2;
+	    if (q2 > _support2)
 	       return 0.0;
+	    return Kernel::eval(q2);
+	 }
+
+	 // first and second derivatives with respect to the squared
+	 // distance, within the support
+	 inline
+	 double slope (double squared_distance) const
+	 {
+	    return Kernel::slope(squared_distance * _inv_r2) * _inv_r2;
+	 }
+
+	 inline
+	 double slope2 (double squared_distance) const
+	 {
+	    return Kernel::slope2(squared_distance * _inv_r2) *
+	       _inv_r2 * _inv_r2;
+	 }
+
+	 // bound of the norm of the third derivative of v -> f(v) for
+	 // squared norms of v in [min2, max2], within the support
+	 inline
+	 double jerk (double min2, double max2) const
+	 {
+	    return Kernel::jerk(min2 * _inv_r2, max2 * _inv_r2) *
+	       _inv_r2 * sqrt(_inv_r2);
 	 }
    };
 
+   typedef Kernel_function<Tent_kernel> Tent_function;
+   typedef Kernel_function<Uniform_kernel> Uniform_function;
+   typedef Kernel_function<Epanechnikov_kernel> Epanechnikov_function;
+   typedef Kernel_function<Biweight_kernel> Biweight_function;
+   typedef Kernel_function<Gaussian_kernel> Gaussian_function;
+
   template <class Type, class Function>
   class Convolution_functor
   {
     const KD_tree &_kd;
     const std::vector<Type> &_field;
     const Function &_f;
+    double _eps;
 
   public:
     Convolution_functor(const KD_tree &kd,
 			const std::vector<Type> &input,
-			const Function &f):  _kd(kd),
-					     _field(input),
-					     _f(f)
+			const Function &f,
+			double eps = 0.0):  _kd(kd),
+					    _field(input),
+					    _f(f),
+					    _eps(eps)
     {}
 
     Type operator() (const uvector &position) const
     {
       std::vector<size_t> indices;
+      std::vector<double> squared_distances;
       
       _kd.find_points_in_ball(position, _f.support_radius(),
-			      indices);
+			      indices, squared_distances, _eps);
       
       if (indices.size() > 0)
 	{
-	  Type res = _field[indices[0]];
+	  Type res = _f(squared_distances[0]) * _field[indices[0]];
 	  for (size_t j = 1; j < indices.size(); ++j)
-	    res += _f(_kd[indices[j]]) * _field[indices[j]];      
+	    res += _f(squared_distances[j]) * _field[indices[j]];      
 	  return res;
 	}
       else
 	{
-	  size_t nn = _kd.find_nn(position);  
+	  size_t nn = _kd.find_nn(position, _eps);  
 	  return _field[nn];
 	}
     }
@@ -91,18 +222,21 @@ namespace cloudy
   {
     const KD_tree &_kd;
     const std::vector<Type> &_field;
+    double _eps;
 
   public:
     Nearest_neighbor_functor(const KD_tree &kd,
-			     const std::vector<Type> &input):  _kd(kd),
-							       _field(input)
+			     const std::vector<Type> &input,
+			     double eps = 0.0):  _kd(kd),
+						 _field(input),
+						 _eps(eps)
     {}
 
     Type operator() (const uvector &position) const
     {
       std::vector<size_t> indices;
       
-      size_t nn = _kd.find_nn(position);  
+      size_t nn = _kd.find_nn(position, _eps);  
       return _field[nn];
     }
   };
@@ -116,8 +250,8 @@ namespace cloudy
   public:
     Convolution_tent_functor(const KD_tree &kd,
 				const std::vector<Type> &input,
-				double r):
-      Convolution_functor<Type, Tent_function>(kd, input, _realf),
+				double r, double eps = 0.0):
+      Convolution_functor<Type, Tent_function>(kd, input, _realf, eps),
       _realf(r)
     {
     }
@@ -131,43 +265,372 @@ namespace cloudy
   public:
     Convolution_uniform_functor(const KD_tree &kd,
 				const std::vector<Type> &input,
-				double r):
-      Convolution_functor<Type, Uniform_function>(kd, input, _realf),
+				double r, double eps = 0.0):
+      Convolution_functor<Type, Uniform_function>(kd, input, _realf, eps),
       _realf(r)
     {
     }
   };
 
-   template <class Type, class Function> 
-   void convolve(const KD_tree &kd,
+  template<class Type, class Kernel>
+  class Convolution_kernel_functor:
+    public Convolution_functor<Type, Kernel_function<Kernel> >
+  {
+    Kernel_function<Kernel> _realf;
+  public:
+    Convolution_kernel_functor(const KD_tree &kd,
+			       const std::vector<Type> &input,
+			       double r, double eps = 0.0):
+      Convolution_functor<Type, Kernel_function<Kernel> >(kd, input,
+							   _realf, eps),
+      _realf(r)
+    {
+    }
+  };
+
+   // The kernel is evaluated on the squared distance from each point
+   // to its neighbours, as returned by the ball query. The points are
+   // distributed among the threads; each of them owns its neighbour
+   // buffers, so that the inner loop does not allocate. The index is
+   // a KD_tree or a Grid_index.
+   template <class Type, class Function, class Index> 
+   void convolve(const Index &kd,
 		 const std::vector<Type> &input,
                  std::vector<Type> &output,
-		 const Function &f)
+		 const Function &f,
+		 double eps = 0.0)
    {
       assert(input.size() == kd.size());
       output.resize(input.size());
 
-      for (size_t i = 0; i < kd.size(); ++i)
+#pragma omp parallel
+      {
+	 std::vector<int> indices(64);
+	 std::vector<double> squared_distances(64);
+
+#pragma omp for schedule(dynamic, 256)
+	 for (long i = 0; i < long(kd.size()); ++i)
+	 {
+	    size_t k = kd.find_points_in_ball(kd.coordinates(i),
+					      f.support_radius(),
+					      indices, squared_distances,
+					      eps);
+
+	    for (size_t j = 0; j < k; ++j)
+	    {
+	       if (j == 0)
+		  output[i] = f(squared_distances[j]) * input[indices[j]];
+	       else
+		  output[i] += f(squared_distances[j]) * input[indices[j]];
+	    }
+	 }
+      }
+   }
+
+   // Access to the components of a field value, so that scalar and
+   // vector fields can be accumulated component-wise.
+   inline size_t field_size (const double &) { return 1; }
+   inline size_t field_size (const uvector &v) { return v.size(); }
+   inline double &field_component (double &v, size_t) { return v; }
+   inline double &field_component (uvector &v, size_t c) { return v[c]; }
+   inline void field_resize (double &, size_t) {}
+   inline void field_resize (uvector &v, size_t n) { v.resize(n); }
+
+   // Copy a field to a flat array of C components per point, and back.
+   template <class Type>
+   size_t
+   field_to_flat (const std::vector<Type> &field, std::vector<double> &flat)
+   {
+      const size_t C = field.size() ? field_size(field[0]) : 0;
+      flat.resize(field.size() * C);
+      for (size_t i = 0; i < field.size(); ++i)
+      {
+	 Type v = field[i];
+	 for (size_t c = 0; c < C; ++c)
+	    flat[i * C + c] = field_component(v, c);
+      }
+      return C;
+   }
+
+   template <class Type>
+   void
+   flat_to_field (const std::vector<double> &flat, size_t C,
+		  std::vector<Type> &field)
+   {
+      field.resize(C ? flat.size() / C : 0);
+      for (size_t i = 0; i < field.size(); ++i)
+      {
+	 field_resize(field[i], C);
+	 for (size_t c = 0; c < C; ++c)
+	    field_component(field[i], c) = flat[i * C + c];
+      }
+   }
+
+   template <class Function>
+   class Pair_convolution_functor
+   {
+	 const Function &_f;
+	 const std::vector<double> &_input;
+	 std::vector<double> &_output;
+	 size_t _size;
+
+      public:
+	 Pair_convolution_functor (const Function &f,
+				   const std::vector<double> &input,
+				   std::vector<double> &output,
+				   size_t size) :
+	    _f(f), _input(input), _output(output), _size(size)
+	 {}
+
+	 inline void
+	 operator () (size_t i, size_t j, double squared_distance)
+	 {
+	    const double w = _f(squared_distance);
+	    for (size_t c = 0; c < _size; ++c)
+	    {
+	       const double vi = w * _input[i * _size + c];
+	       const double vj = w * _input[j * _size + c];
+#pragma omp atomic
+	       _output[i * _size + c] += vj;
+#pragma omp atomic
+	       _output[j * _size + c] += vi;
+	    }
+	 }
+   };
+
+   // Same as convolve, for a radially symmetric kernel: every pair of
+   // neighbours is visited once through a cell list, and contributes
+   // to both of its points. The field is accumulated component-wise
+   // with atomic additions. Only 3D clouds are handled this way.
+   template <class Type, class Function> 
+   void convolve_pairs(const KD_tree &kd,
+		       const std::vector<Type> &input,
+		       std::vector<Type> &output,
+		       const Function &f)
+   {
+      assert(input.size() == kd.size());
+      if (kd.dim() != 3 || input.size() == 0)
+      {
+	 convolve(kd, input, output, f);
+	 return;
+      }
+
+      std::vector<double> in, out;
+      const size_t C = field_to_flat(input, in);
+      const double f0 = f(0.0);
+      out.resize(in.size());
+      for (size_t i = 0; i < in.size(); ++i)
+	 out[i] = f0 * in[i];
+
+      Grid_index grid(kd, f.support_radius());
+      Pair_convolution_functor<Function> pf(f, in, out, C);
+      grid.for_each_pair(f.support_radius(), pf);
+
+      flat_to_field(out, C, output);
+   }
+
+   // Tree-code approximation of convolve. The moments of the field
+   // over the nodes of a Box_tree are computed once: for node n with
+   // centroid c, the sums S0, S1 and S2 of v(p), v(p) (p - c) and
+   // v(p) (p - c)(p - c)^t over its points p. For a query q, the
+   // kernel g(p) = f(|p - q|^2) is expanded to second order about c,
+   //   sum_p g(p) v(p) ~ g(c) S0 + grad g(c) . S1 + D2 g(c) : S2 / 2,
+   // and a node inside the support is accepted when the remainder is
+   // at most tol per unit of |field|. The remainder is bounded by
+   // f.jerk / 6 times the spread of the node, the mean of |p - c|^3
+   // weighted by |v(p)| (its largest component, for a vector field).
+   // The other nodes are opened, down to the leaves, which are summed
+   // exactly. The absolute error is thus at most tol times the sum of
+   // |field| over the support, and usually orders of magnitude
+   // smaller. Large nodes pass where the kernel is smooth, so the
+   // tree code pays off when the support holds many points; it is
+   // exact for the uniform and Epanechnikov kernels, whatever tol.
+   template <class Type, class Function> 
+   void convolve_tree(const KD_tree &kd,
+		      const std::vector<Type> &input,
+		      std::vector<Type> &output,
+		      const Function &f,
+		      double tol)
+   {
+      assert(input.size() == kd.size());
+      if (input.size() == 0)
       {
-	 std::vector<size_t> indices;
+	 output.clear();
+	 return;
+      }
+
+      std::vector<double> in, out;
+      const size_t C = field_to_flat(input, in);
+      out.assign(in.size(), 0.0);
+
+      Box_tree tree(kd);
+      const double R2 = f.support_radius() * f.support_radius();
+      const size_t dim = tree.dim(), dim2 = dim * dim;
+      const size_t N = tree.num_nodes();
 
-	 kd.find_points_in_ball(kd[i],
-				f.support_radius(),
-				indices);
+      // centroids, spreads and moments of the nodes; for component k,
+      // S1 holds a vector and S2 a dim x dim matrix
+      std::vector<double> centers(dim * N, 0.0), spread3(N, 0.0);
+      std::vector<double> S0(C * N, 0.0), S1(C * dim * N, 0.0);
+      std::vector<double> S2(C * dim2 * N, 0.0);
+
+#pragma omp parallel
+      {
+	 std::vector<double> delta(dim);
+
+#pragma omp for schedule(dynamic, 64)
+	 for (long n = 0; n < long(N); ++n)
+	 {
+	    const Box_tree::Node &node = tree.node(n);
+	    double *c = &centers[dim * n];
+	    for (size_t j = node.begin; j < node.end; ++j)
+	       for (size_t d = 0; d < dim; ++d)
+		  c[d] += tree.point(j)[d];
+	    for (size_t d = 0; d < dim; ++d)
+	       c[d] /= double(node.end - node.begin);
+
+	    double *s0 = &S0[C * n], *s1 = &S1[C * dim * n];
+	    double *s2 = &S2[C * dim2 * n];
+	    double mass = 0.0, spread = 0.0;
+	    for (size_t j = node.begin; j < node.end; ++j)
+	    {
+	       const double *p = tree.point(j);
+	       const double *v = &in[C * tree.index(j)];
+	       double d2 = 0.0, w = 0.0;
+	       for (size_t d = 0; d < dim; ++d)
+	       {
+		  delta[d] = p[d] - c[d];
+		  d2 += delta[d] * delta[d];
+	       }
+	       for (size_t k = 0; k < C; ++k)
+	       {
+		  w = std::max(w, fabs(v[k]));
+		  s0[k] += v[k];
+		  for (size_t d = 0; d < dim; ++d)
+		  {
+		     s1[dim * k + d] += v[k] * delta[d];
+		     for (size_t e = 0; e < dim; ++e)
+			s2[dim2 * k + dim * d + e] += v[k] * delta[d] * delta[e];
+		  }
+	       }
+	       mass += w;
+	       spread += w * d2 * sqrt(d2);
+	    }
+	    spread3[n] = (mass > 0.0) ? spread / mass : 0.0;
+	 }
+      }
 
-	 output[i] = input[indices[0]];
-	 for (size_t j = 1; j < indices.size(); ++j)
-	    output[i] += f(kd[indices[j]]) * input[indices[j]];
+#pragma omp parallel
+      {
+	 std::vector<size_t> stack;
+	 std::vector<double> u(dim);
+
+	 // the points are taken in tree order, for coherence
+#pragma omp for schedule(dynamic, 256)
+	 for (long i = 0; i < long(tree.size()); ++i)
+	 {
+	    const double *q = tree.point(i);
+	    double *o = &out[C * tree.index(i)];
+
+	    stack.clear();
+	    stack.push_back(0);
+	    while (!stack.empty())
+	    {
+	       const size_t n = stack.back();
+	       stack.pop_back();
+
+	       double dmin2, dmax2;
+	       tree.box_distances(n, q, dmin2, dmax2);
+	       if (dmin2 > R2)
+		  continue;
+
+	       if (dmax2 <= R2 && f.jerk(dmin2, dmax2) * spread3[n] <= 6.0 * tol)
+	       {
+		  // with u = c - q, grad g(c) = 2 f' u and
+		  // D2 g(c) = 2 f' I + 4 f'' u u^t
+		  const double *c = &centers[dim * n];
+		  double d2 = 0.0;
+		  for (size_t d = 0; d < dim; ++d)
+		  {
+		     u[d] = c[d] - q[d];
+		     d2 += u[d] * u[d];
+		  }
+		  const double f0 = f(d2), f1 = f.slope(d2), f2 = f.slope2(d2);
+		  const double *s0 = &S0[C * n], *s1 = &S1[C * dim * n];
+		  const double *s2 = &S2[C * dim2 * n];
+		  for (size_t k = 0; k < C; ++k)
+		  {
+		     double first = 0.0, trace = 0.0, quad = 0.0;
+		     for (size_t d = 0; d < dim; ++d)
+		     {
+			const double *row = &s2[dim2 * k + dim * d];
+			first += u[d] * s1[dim * k + d];
+			trace += row[d];
+			for (size_t e = 0; e < dim; ++e)
+			   quad += u[d] * row[e] * u[e];
+		     }
+		     o[k] += f0 * s0[k] + 2.0 * f1 * first + f1 * trace +
+			2.0 * f2 * quad;
+		  }
+		  continue;
+	       }
+
+	       const Box_tree::Node &node = tree.node(n);
+	       if (tree.is_leaf(n))
+	       {
+		  for (size_t j = node.begin; j < node.end; ++j)
+		  {
+		     const double *p = tree.point(j);
+		     double d2 = 0.0;
+		     for (size_t d = 0; d < dim; ++d)
+			d2 += (p[d] - q[d]) * (p[d] - q[d]);
+		     const double w = f(d2);
+		     if (w == 0.0)
+			continue;
+		     const double *v = &in[C * tree.index(j)];
+		     for (size_t k = 0; k < C; ++k)
+			o[k] += w * v[k];
+		  }
+	       }
+	       else
+	       {
+		  stack.push_back(node.right);
+		  stack.push_back(node.left);
+	       }
+	    }
+	 }
+      }
+
+      flat_to_field(out, C, output);
+   }
+
+   // Applies convolve iterations times, with the kernel and the
+   // neighbourhoods cached in graph (see Neighbor_graph).
+   template <class Type> 
+   void convolve_graph(const Neighbor_graph &graph,
+		       const std::vector<Type> &input,
+		       std::vector<Type> &output,
+		       size_t iterations = 1)
+   {
+      assert(input.size() == graph.size());
+      std::vector<double> in, out;
+      const size_t C = field_to_flat(input, in);
+      for (size_t it = 0; it < iterations; ++it)
+      {
+	 graph.multiply(in, C, out);
+	 in.swap(out);
       }
+      flat_to_field(in, C, output);
    }
 
-   template <class Type>    
-   void convolve_uniform(const KD_tree &kd,
+   template <class Type, class Index>    
+   void convolve_uniform(const Index &kd,
                          const std::vector<Type> &input,
                          std::vector<Type> &output,
-                         double R)
+                         double R,
+                         double eps = 0.0)
    {
-      convolve<Type>(kd, input, output, Uniform_function(R));
+      convolve<Type>(kd, input, output, Uniform_function(R), eps);
    }
 }
 
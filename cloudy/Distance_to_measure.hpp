@@ -0,0 +1,85 @@
+#ifndef CLOUDY_DISTANCE_TO_MEASURE_HPP
+#define CLOUDY_DISTANCE_TO_MEASURE_HPP
+
+#include <cloudy/Cloud.hpp>
+#include <cloudy/KD_tree.hpp>
+#include <vector>
+
+namespace cloudy
+{
+   // Distance to the measures of masses m[0] < ... < m[M-1]: the
+   // neighbours of P are visited by increasing distance until their
+   // weight reaches m[M-1], and the squared distance for each mass is
+   // read off the running sums when the mass is reached, the last
+   // neighbour being counted partially. The barycenter is the one of the
+   // largest mass. If D > 0, the search is aborted (and 10.0 returned
+   // for the remaining masses) as soon as the distance exceeds D: since
+   // the squared distances are visited in increasing order, the running
+   // mean can only grow.
+   //
+   // The neighbours further than sqrt(squared_bound) are not visited;
+   // the squared distance to the last neighbour is returned in
+   // squared_radius (or ANN_DIST_INF if the search was aborted). With
+   // eps > 0, the neighbours are only enumerated approximately in order.
+   inline void
+   k_distance(const std::vector<double> &m, double D,
+	      const KD_tree &kd, 
+	      const std::vector<double> &W,
+	      const uvector &P,
+	      double *h,
+	      uvector &bary,
+	      KD_tree::Nearest_neighbor_iterator &nn,
+	      double squared_bound,
+	      double &squared_radius,
+	      double eps = 0.0)
+   {        
+      const double EPSILON = 1e-6;
+      const size_t dim = kd.dim();
+      const size_t M = m.size();
+      double totalw = 0.0;
+      double sumd = 0.0;
+      size_t j = 0;
+
+      bary.resize(dim);
+      bary.clear();
+      squared_radius = ANN_DIST_INF;
+
+      nn.start(P, eps, squared_bound);
+      size_t idx;
+      double sqd = 0.0;
+      while (j < M && nn.next(idx, sqd))
+      {
+	 double w = W[idx];
+	 for (; j < M && totalw + w >= m[j] - EPSILON; ++j)
+	    h[j] = (sumd + (m[j] - totalw)*sqd) / m[j];
+	 if (j == M)
+	    w = m[M - 1] - totalw;
+
+	 const double *q = kd.coordinates(idx);
+	 for (size_t d = 0; d < dim; ++d)
+	    bary[d] += w*q[d];
+	 sumd += w*sqd;
+	 totalw += w;
+
+	 if (D > 0.0 && j < M && sumd >= D*D*totalw)
+	    break;
+      }
+
+      if (j == M)
+	 squared_radius = sqd;
+
+      // aborted, or the search bound (or the cloud) ran out before the
+      // mass was reached
+      for (; j < M; ++j)
+	 h[j] = (D > 0.0) ? 10.0 : sumd / totalw;
+
+      if (D > 0.0)
+	 for (j = 0; j < M; ++j)
+	    if (h[j] >= D*D)
+	       h[j] = 10.0;
+
+      bary /= totalw;
+   }
+}
+
+#endif
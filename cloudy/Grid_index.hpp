@@ -0,0 +1,442 @@
+#ifndef CLOUDY_GRID_INDEX_HPP
+#define CLOUDY_GRID_INDEX_HPP
+
+#include <cloudy/Cloud.hpp>
+#include <cloudy/KD_tree.hpp>
+#include <algorithm>
+#include <vector>
+#include <float.h>
+#include <math.h>
+
+namespace cloudy
+{
+   // Uniform grid (cell list) over a cloud, built on its first three
+   // coordinates. The points are sorted by cell with a counting sort,
+   // and their coordinates are stored contiguously in that order, so
+   // that a cell is a range of the sorted arrays. When the cells are
+   // at least as large as the search radius, the neighbours of a point
+   // lie in the 27 cells around its own. Distances are computed on all
+   // the coordinates (e.g. the lifted weight of pctoffsetmc), which can
+   // only make them larger than their projection on the grid.
+   //
+   // The query interface is the one of KD_tree, so that both can be
+   // used by the same templates; the queries are exact and eps is
+   // ignored. Ball queries do not return the points by increasing
+   // distance.
+   class Grid_index
+   {
+	 size_t _dim;
+	 double _lo[3];
+	 double _cell;
+	 size_t _n[3];
+	 std::vector<size_t> _start;	// first sorted point of each cell
+	 std::vector<size_t> _order;	// original index of sorted points
+	 std::vector<size_t> _rank;	// sorted index of original points
+	 std::vector<double> _coords;	// sorted coordinates
+
+	 template <class Points>
+	 void
+	 _build (const Points &points, size_t N, double cell)
+	 {
+	    // the cells are only ever enlarged below
+	    assert (cell > 0.0 && cell <= DBL_MAX);
+
+	    double hi[3];
+	    for (size_t d = 0; d < 3; ++d)
+	       _lo[d] = hi[d] = (N > 0) ? points(0, d) : 0.0;
+	    for (size_t i = 1; i < N; ++i)
+	       for (size_t d = 0; d < 3; ++d)
+	       {
+		  _lo[d] = std::min(_lo[d], points(i, d));
+		  hi[d] = std::max(hi[d], points(i, d));
+	       }
+
+	    // keep the number of cells in O(N) for sparse clouds, by
+	    // enlarging them if needed
+	    _cell = cell;
+	    while (true)
+	    {
+	       double cells = 1.0;
+	       for (size_t d = 0; d < 3; ++d)
+	       {
+		  _n[d] = size_t((hi[d] - _lo[d]) / _cell) + 1;
+		  cells *= double(_n[d]);
+	       }
+	       if (cells <= 8.0 * double(N) + 64.0)
+		  break;
+	       _cell *= 1.25;
+	    }
+
+	    std::vector<size_t> cell_of(N);
+	    _start.assign(_n[0] * _n[1] * _n[2] + 1, 0);
+	    for (size_t i = 0; i < N; ++i)
+	    {
+	       cell_of[i] = cell_index(points(i, 0), points(i, 1),
+				       points(i, 2));
+	       ++_start[cell_of[i] + 1];
+	    }
+	    for (size_t c = 1; c < _start.size(); ++c)
+	       _start[c] += _start[c - 1];
+
+	    std::vector<size_t> fill(_start.begin(), _start.end() - 1);
+	    _order.resize(N);
+	    _rank.resize(N);
+	    _coords.resize(_dim * N);
+	    for (size_t i = 0; i < N; ++i)
+	    {
+	       size_t s = fill[cell_of[i]]++;
+	       _order[s] = i;
+	       _rank[i] = s;
+	       for (size_t d = 0; d < _dim; ++d)
+		  _coords[_dim * s + d] = points(i, d);
+	    }
+	 }
+
+	 struct Tree_points
+	 {
+	       const KD_tree &kd;
+	       double operator () (size_t i, size_t d) const
+	       {
+		  return kd.coordinates(i)[d];
+	       }
+	 };
+
+	 struct Cloud_points
+	 {
+	       const Data_cloud &c;
+	       double operator () (size_t i, size_t d) const
+	       {
+		  return c[i][d];
+	       }
+	 };
+
+	 double
+	 _squared_distance (const double *p, const double *q) const
+	 {
+	    double d2 = 0.0;
+	    for (size_t d = 0; d < _dim; ++d)
+	       d2 += (p[d] - q[d]) * (p[d] - q[d]);
+	    return d2;
+	 }
+
+	 // Call f(index, squared_distance) for the points in the ball
+	 template <class Functor>
+	 void
+	 _for_each_in_ball (const double *q, double r, Functor &f) const
+	 {
+	    const double r2 = r * r;
+	    size_t lo[3], hi[3];
+	    for (size_t d = 0; d < 3; ++d)
+	    {
+	       lo[d] = cell_coordinate(q[d] - r, d);
+	       hi[d] = cell_coordinate(q[d] + r, d);
+	    }
+
+	    for (size_t z = lo[2]; z <= hi[2]; ++z)
+	       for (size_t y = lo[1]; y <= hi[1]; ++y)
+	       {
+		  // the cells of a row are contiguous
+		  const size_t row = (z * _n[1] + y) * _n[0];
+		  const size_t b = _start[row + lo[0]];
+		  const size_t e = _start[row + hi[0] + 1];
+		  for (size_t s = b; s < e; ++s)
+		  {
+		     double d2 = _squared_distance(q, &_coords[_dim * s]);
+		     if (d2 <= r2)
+			f(_order[s], d2);
+		  }
+	       }
+	 }
+
+	 struct Ball_collector
+	 {
+	       std::vector<int> &indices;
+	       std::vector<double> &squared_distances;
+	       size_t k;
+
+	       void operator () (size_t i, double d2)
+	       {
+		  if (k >= indices.size())
+		  {
+		     indices.resize(std::max(size_t(16), 2 * k));
+		     squared_distances.resize(indices.size());
+		  }
+		  indices[k] = i;
+		  squared_distances[k] = d2;
+		  ++k;
+	       }
+	 };
+
+	 struct Ball_counter
+	 {
+	       size_t k, nn;
+	       double d2;
+
+	       void operator () (size_t i, double sqd)
+	       {
+		  if (k == 0 || sqd < d2)
+		  {
+		     nn = i;
+		     d2 = sqd;
+		  }
+		  ++k;
+	       }
+	 };
+
+      public:
+	 Grid_index (const KD_tree &kd, double cell) : _dim(kd.dim())
+	 {
+	    assert (kd.dim() >= 3);
+	    Tree_points tp = {kd};
+	    _build(tp, kd.size(), cell);
+	 }
+
+	 Grid_index (const Data_cloud &c, double cell) :
+	    _dim(c.size() ? c[0].size() : 3)
+	 {
+	    assert (_dim >= 3);
+	    Cloud_points cp = {c};
+	    _build(cp, c.size(), cell);
+	 }
+
+	 size_t size() const
+	 {
+	    return _order.size();
+	 }
+
+	 size_t dim() const
+	 {
+	    return _dim;
+	 }
+
+	 const double *
+	 coordinates (size_t idx) const
+	 {
+	    return &_coords[_dim * _rank[idx]];
+	 }
+
+	 uvector
+	 operator [] (size_t idx) const
+	 {
+	    uvector v(_dim);
+	    std::copy(coordinates(idx), coordinates(idx) + _dim, v.begin());
+	    return v;
+	 }
+
+	 size_t
+	 find_points_in_ball(const double *p,
+			     double r,
+			     std::vector<int> &indices,
+			     std::vector<double> &squared_distances,
+			     double = 0.0) const
+	 {
+	    squared_distances.resize(indices.size());
+	    Ball_collector bc = {indices, squared_distances, 0};
+	    _for_each_in_ball(p, r, bc);
+	    return bc.k;
+	 }
+
+	 void
+	 find_points_in_ball(const uvector &p,
+			     double r,
+			     std::vector<size_t> &indices,
+			     std::vector<double> &squared_distances,
+			     double eps = 0.0) const
+	 {
+	    assert (p.size() == _dim);
+	    std::vector<double> query(p.begin(), p.end());
+	    std::vector<int> iindices;
+	    size_t k = find_points_in_ball(&query.front(), r, iindices,
+					   squared_distances, eps);
+	    indices.assign(iindices.begin(), iindices.begin() + k);
+	    squared_distances.resize(k);
+	 }
+
+	 void
+	 find_points_in_ball(const uvector &p,
+			     double r,
+			     std::vector<size_t> &indices,
+			     double eps = 0.0) const
+	 {
+	    std::vector<double> squared_distances;
+	    find_points_in_ball(p, r, indices, squared_distances, eps);
+	 }
+
+	 size_t
+	 count_points_in_ball(const uvector &p,
+			      double r,
+			      double eps = 0.0) const
+	 {
+	    size_t nn;
+	    double squared_distance;
+	    return count_points_in_ball(p, r, nn, squared_distance, eps);
+	 }
+
+	 // nn and squared_distance are only set when the ball is not
+	 // empty.
+	 size_t
+	 count_points_in_ball(const uvector &p,
+			      double r,
+			      size_t &nn,
+			      double &squared_distance,
+			      double = 0.0) const
+	 {
+	    assert (p.size() == _dim);
+	    double query[16];
+	    std::vector<double> big;
+	    double *q = query;
+	    if (_dim > 16)
+	    {
+	       big.resize(_dim);
+	       q = &big.front();
+	    }
+	    std::copy(p.begin(), p.end(), q);
+
+	    Ball_counter bc = {0, 0, 0.0};
+	    _for_each_in_ball(q, r, bc);
+	    if (bc.k > 0)
+	    {
+	       nn = bc.nn;
+	       squared_distance = bc.d2;
+	    }
+	    return bc.k;
+	 }
+
+	 // Nearest point, found by scanning shells of cells of growing
+	 // (Chebyshev) radius around the cell of p. The points outside
+	 // the shells 0..k are at distance at least k times the cell
+	 // size, even if p is outside the grid, since the projection on
+	 // the grid's box does not increase distances.
+	 size_t
+	 find_nn(const uvector &p, double = 0.0) const
+	 {
+	    assert (p.size() == _dim);
+	    assert (size() > 0);
+	    std::vector<double> q(p.begin(), p.end());
+
+	    long c[3];
+	    for (size_t d = 0; d < 3; ++d)
+	       c[d] = cell_coordinate(q[d], d);
+	    const long kmax = std::max(_n[0], std::max(_n[1], _n[2]));
+
+	    size_t best = 0;
+	    double best_d2 = -1.0;
+	    for (long k = 0; k <= kmax; ++k)
+	    {
+	       for (long z = c[2] - k; z <= c[2] + k; ++z)
+		  for (long y = c[1] - k; y <= c[1] + k; ++y)
+		  {
+		     if (z < 0 || z >= long(_n[2]) || y < 0 || y >= long(_n[1]))
+			continue;
+		     const bool inner = (z != c[2] - k && z != c[2] + k &&
+					 y != c[1] - k && y != c[1] + k);
+		     for (long x = c[0] - k; x <= c[0] + k;
+			  x += (inner && k > 0) ? 2 * k : 1)
+		     {
+			if (x < 0 || x >= long(_n[0]))
+			   continue;
+			const size_t o = (z * _n[1] + y) * _n[0] + x;
+			for (size_t s = _start[o]; s < _start[o + 1]; ++s)
+			{
+			   double d2 = _squared_distance(&q.front(),
+							 &_coords[_dim * s]);
+			   if (best_d2 < 0.0 || d2 < best_d2)
+			   {
+			      best = _order[s];
+			      best_d2 = d2;
+			   }
+			}
+		     }
+		  }
+
+	       const double bound = k * _cell;
+	       if (best_d2 >= 0.0 && best_d2 <= bound * bound)
+		  break;
+	    }
+	    return best;
+	 }
+
+	 double cell_size() const
+	 {
+	    return _cell;
+	 }
+
+	 size_t num_cells() const
+	 {
+	    return _start.size() - 1;
+	 }
+
+	 size_t
+	 cell_coordinate (double x, size_t d) const
+	 {
+	    double c = floor((x - _lo[d]) / _cell);
+	    if (c < 0.0)
+	       return 0;
+	    return std::min(size_t(c), _n[d] - 1);
+	 }
+
+	 size_t
+	 cell_index (double x, double y, double z) const
+	 {
+	    return (cell_coordinate(z, 2) * _n[1] + cell_coordinate(y, 1))
+	       * _n[0] + cell_coordinate(x, 0);
+	 }
+
+	 // Call f(i, j, squared_distance) once for every unordered pair
+	 // {i, j} of distinct points at distance at most r, i and j
+	 // being indices in the original cloud; r must not exceed the
+	 // cell size. Each cell is paired with itself and with the 13
+	 // neighbouring cells that follow it in lexicographic order (a
+	 // half shell), so that no pair is seen twice. The cells are
+	 // distributed among the threads: f must be thread-safe.
+	 template <class Functor>
+	 void
+	 for_each_pair (double r, Functor &f) const
+	 {
+	    assert (r <= _cell);
+	    const double r2 = r * r;
+	    const long nx = _n[0], ny = _n[1], nz = _n[2];
+
+#pragma omp parallel for schedule(dynamic, 16)
+	    for (long c = 0; c < long(num_cells()); ++c)
+	    {
+	       const size_t cb = _start[c], ce = _start[c + 1];
+	       if (cb == ce)
+		  continue;
+
+	       // pairs within the cell
+	       for (size_t a = cb; a < ce; ++a)
+		  for (size_t b = a + 1; b < ce; ++b)
+		  {
+		     double d2 = _squared_distance(&_coords[_dim * a],
+						   &_coords[_dim * b]);
+		     if (d2 <= r2)
+			f(_order[a], _order[b], d2);
+		  }
+
+	       const long x = c % nx, y = (c / nx) % ny, z = c / (nx * ny);
+	       for (long dz = 0; dz <= 1; ++dz)
+		  for (long dy = (dz ? -1 : 0); dy <= 1; ++dy)
+		     for (long dx = (dz || dy ? -1 : 1); dx <= 1; ++dx)
+		     {
+			long xx = x + dx, yy = y + dy, zz = z + dz;
+			if (xx < 0 || xx >= nx || yy < 0 || yy >= ny ||
+			    zz >= nz)
+			   continue;
+
+			const size_t o = (zz * ny + yy) * nx + xx;
+			for (size_t a = cb; a < ce; ++a)
+			   for (size_t b = _start[o]; b < _start[o + 1]; ++b)
+			   {
+			      double d2 = _squared_distance(&_coords[_dim * a],
+							    &_coords[_dim * b]);
+			      if (d2 <= r2)
+				 f(_order[a], _order[b], d2);
+			   }
+		     }
+	    }
+	 }
+   };
+}
+
+#endif
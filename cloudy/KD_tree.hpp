@@ -36,6 +36,13 @@ namespace cloudy
 	    return v;
 	 }	 
 
+	 // Coordinates of a point, without the copy done by operator[].
+	 const double *
+	 coordinates (size_t idx) const
+	 {
+	    return _points[idx];
+	 }
+
 	 size_t size() const
 	 {
 	    return _points.size();
@@ -92,8 +99,22 @@ namespace cloudy
 	    std::copy(iindices.begin(), iindices.end(), indices.begin());
 	 }
 
+	 // Same as above, for a query given by its coordinates, into
+	 // buffers of at least k entries owned by the caller, so that
+	 // repeated queries do not allocate. The neighbours come by
+	 // increasing distance.
+	 void
+	 find_knn(const double *p, size_t k,
+		  int *indices, double *squared_distances,
+		  double eps = 0.0) const
+	 {
+	    assert (_tree != NULL);
+	    _tree->annkSearch(const_cast<ANNpoint>(p), k,
+			      indices, squared_distances, eps);
+	 }
+
 	 size_t
-	 find_nn(const uvector &p) const
+	 find_nn(const uvector &p, double eps = 0.0) const
 	 {
 	    std::vector<double> query(_dim);
 	    std::vector<int> indices(1);
@@ -104,7 +125,7 @@ namespace cloudy
 
 	    _tree->annkSearch(&query.front(),
 			      1, &indices.front(),
-			      &squared_distances.front(), 0);
+			      &squared_distances.front(), eps);
 	    return indices[0];
 	 }
      
@@ -132,6 +153,60 @@ namespace cloudy
 	    std::copy(iindices.begin(), iindices.end(), indices.begin());
 	 }
      
+	 // Same as above, but the squared distances to the query are
+	 // returned along with the indices.
+	 void
+	 find_points_in_ball(const uvector &p,
+			     double r,
+			     std::vector<size_t> &indices,
+			     std::vector<double> &squared_distances,
+			     double eps = 0.0) const
+	 {
+	    assert (p.size() == _dim);
+
+	    std::vector<double> query(_dim);
+	    std::vector<int> iindices;
+	    std::copy(p.begin(), p.end(), query.begin());
+	    size_t k = find_points_in_ball(&query.front(), r, iindices,
+					   squared_distances, eps);
+
+	    indices.resize(k);
+	    squared_distances.resize(k);
+	    std::copy(iindices.begin(), iindices.begin() + k,
+		      indices.begin());
+	 }
+
+	 // Same as above, for a query given by its coordinates. The
+	 // indices and squared distances are written to buffers owned
+	 // by the caller, which are only reallocated when they are too
+	 // small, so that repeated queries do not allocate. Only the
+	 // first k entries, k being the returned value, are meaningful.
+	 size_t
+	 find_points_in_ball(const double *p,
+			     double r,
+			     std::vector<int> &indices,
+			     std::vector<double> &squared_distances,
+			     double eps = 0.0) const
+	 {
+	    assert (_tree != NULL);
+
+	    ANNpoint q = const_cast<ANNpoint>(p);
+	    size_t capacity = std::min(indices.size(),
+				       squared_distances.size());
+	    size_t k = _tree->annkFRSearch
+	       (q, r*r, capacity,
+		capacity ? &indices.front() : NULL,
+		capacity ? &squared_distances.front() : NULL, eps);
+	    if (k > capacity)
+	    {
+	       indices.resize(std::max(k, 2 * capacity));
+	       squared_distances.resize(indices.size());
+	       _tree->annkFRSearch(q, r*r, k, &indices.front(),
+				   &squared_distances.front(), eps);
+	    }
+	    return k;
+	 }
+
 	 size_t
 	 count_points_in_ball(const uvector &p,
 			      double r,
@@ -146,10 +221,88 @@ namespace cloudy
 	       (&query.front(), r*r, 0, NULL, NULL, eps);   	    
 	 }
 
+	 // Count the points in the ball and find the nearest of them
+	 // within the same traversal. nn and squared_distance are only
+	 // set when the ball is not empty.
+	 size_t
+	 count_points_in_ball(const uvector &p,
+			      double r,
+			      size_t &nn,
+			      double &squared_distance,
+			      double eps = 0.0) const
+	 {	    
+	    assert (p.size() == _dim);
+	    assert (_tree != NULL);
+       
+	    std::vector<double> query(_dim);
+	    std::copy(p.begin(), p.end(), query.begin());
+
+	    int inn;
+	    double sqd;
+	    size_t k = _tree->annkFRSearch
+	       (&query.front(), r*r, 1, &inn, &sqd, eps);
+	    if (k > 0)
+	    {
+	       nn = inn;
+	       squared_distance = sqd;
+	    }
+	    return k;
+	 }
+
 	 size_t dim() const
 	 {
 	    return _dim;
 	 }
+
+	 // Enumerate the points by increasing distance to a query
+	 // point. The traversal is resumed at each call to next(), so
+	 // that one can stop as soon as enough neighbours have been
+	 // seen. An iterator may be restarted on another query point
+	 // without reallocating its queue; use one per thread.
+	 class Nearest_neighbor_iterator
+	 {
+	       ANNkd_inc_search _search;
+	       std::vector<double> _query;
+
+	    public:
+	       Nearest_neighbor_iterator (const KD_tree &kd) :
+		  _search(kd._tree), _query(kd._dim)
+	       {
+		  assert (kd._tree != NULL);
+	       }
+
+	       template <class V>
+	       Nearest_neighbor_iterator (const KD_tree &kd, const V &p,
+					  double eps = 0.0) :
+		  _search(kd._tree), _query(kd._dim)
+	       {
+		  assert (kd._tree != NULL);
+		  start(p, eps);
+	       }
+
+	       // Points further than sqrt(squared_bound) are skipped.
+	       template <class V>
+	       void
+	       start (const V &p, double eps = 0.0,
+		      double squared_bound = ANN_DIST_INF)
+	       {
+		  assert (p.size() == _query.size());
+		  std::copy(p.begin(), p.end(), _query.begin());
+		  _search.start(&_query.front(), eps, squared_bound);
+	       }
+
+	       bool
+	       next (size_t &idx, double &squared_distance)
+	       {
+		  ANNidx i;
+		  ANNdist d;
+		  if (!_search.next(i, d))
+		     return false;
+		  idx = i;
+		  squared_distance = d;
+		  return true;
+	       }
+	 };
    };
 }
 
@@ -0,0 +1,84 @@
+#ifndef CLOUDY_LOCAL_COVARIANCE_HPP
+#define CLOUDY_LOCAL_COVARIANCE_HPP
+
+#include <cloudy/KD_tree.hpp>
+#include <cloudy/Moment_tree.hpp>
+#include <cloudy/linear/Matrix_3.hpp>
+#include <algorithm>
+#include <vector>
+
+namespace cloudy
+{
+   // Covariance matrix of the k nearest neighbours of every point of
+   // the tree (the point itself included), about their mean, for
+   // local PCA. The matrices are written to covariances as six
+   // coefficients M11 M12 M13 M22 M23 M33 per point, the layout of .p
+   // covariance files and of linear::covariance_diagonalize_3; only
+   // the first three coordinates are used. Each sum is accumulated in
+   // a single pass with Welford's update, which does not suffer from
+   // the cancellation of sum(p p^t)/k - mean mean^t far from the
+   // origin. The points are processed in parallel.
+   inline void
+   knn_covariance(const KD_tree &kd, size_t k,
+		  std::vector<double> &covariances,
+		  double eps = 0.0)
+   {
+      const size_t n = kd.size(), dim = std::min(kd.dim(), size_t(3));
+      // the point itself is always among its neighbours
+      k = std::max(std::min(k, n), size_t(1));
+      covariances.resize(6 * n);
+
+#pragma omp parallel
+      {
+	 std::vector<int> indices(k);
+	 std::vector<double> squared_distances(k);
+
+#pragma omp for schedule(dynamic, 256)
+	 for (long i = 0; i < long(n); ++i)
+	 {
+	    kd.find_knn(kd.coordinates(i), k, &indices.front(),
+			&squared_distances.front(), eps);
+
+	    linear::Vec3 mean;
+	    linear::Sym3 M;
+	    for (size_t j = 0; j < k; ++j)
+	    {
+	       const double *p = kd.coordinates(indices[j]);
+	       linear::Vec3 delta;
+	       for (size_t d = 0; d < dim; ++d)
+		  delta[d] = p[d] - mean[d];
+	       mean += (1.0 / double(j + 1)) * delta;
+	       M.add_outer(delta, double(j) / double(j + 1));
+	    }
+	    M *= 1.0 / double(k);
+
+	    std::copy(M.begin(), M.end(), covariances.begin() + 6 * i);
+	 }
+      }
+   }
+
+   // Same as knn_covariance, for the neighbours within distance r of
+   // every point, read from the node moments of a Moment_tree (see
+   // Moment_tree::ball_moments for eps). The points are queried in
+   // tree order, for coherence.
+   inline void
+   ball_covariance(const Moment_tree &mt, double r,
+		   std::vector<double> &covariances,
+		   double eps = 0.0)
+   {
+      const Box_tree &tree = mt.tree();
+      covariances.resize(6 * tree.size());
+
+#pragma omp parallel for schedule(dynamic, 256)
+      for (long i = 0; i < long(tree.size()); ++i)
+      {
+	 Moments m;
+	 mt.ball_moments(tree.point(i), r, m, eps);
+	 const linear::Sym3 c = m.covariance();
+	 std::copy(c.begin(), c.end(),
+		   covariances.begin() + 6 * tree.index(i));
+      }
+   }
+}
+
+#endif
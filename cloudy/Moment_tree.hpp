@@ -0,0 +1,214 @@
+#ifndef CLOUDY_MOMENT_TREE_HPP
+#define CLOUDY_MOMENT_TREE_HPP
+
+#include <cloudy/Box_tree.hpp>
+#include <cloudy/linear/Matrix_3.hpp>
+#include <algorithm>
+#include <vector>
+
+namespace cloudy
+{
+   // Moments of order 0, 1 and 2 of a set of points of dimension at
+   // most 3: their number, their mean and their scatter matrix
+   // sum (p - mean)(p - mean)^t. Sets are merged with the pairwise
+   // formula of Chan et al., which stays accurate far from the
+   // origin, unlike sums of p p^t.
+   struct Moments
+   {
+	 size_t count;
+	 linear::Vec3 mean;
+	 linear::Sym3 scatter;
+
+	 Moments () : count(0)
+	 {}
+
+	 void
+	 add (const double *p, size_t dim)
+	 {
+	    linear::Vec3 delta;
+	    for (size_t d = 0; d < dim; ++d)
+	       delta[d] = p[d] - mean[d];
+	    ++count;
+	    mean += (1.0 / double(count)) * delta;
+	    scatter.add_outer(delta, double(count - 1) / double(count));
+	 }
+
+	 void
+	 add (const Moments &m)
+	 {
+	    if (m.count == 0)
+	       return;
+	    const size_t n = count + m.count;
+	    const linear::Vec3 delta = m.mean - mean;
+	    mean += (double(m.count) / double(n)) * delta;
+	    scatter += m.scatter;
+	    scatter.add_outer(delta, double(count) * double(m.count) / double(n));
+	    count = n;
+	 }
+
+	 // covariance about the mean (zero for an empty set)
+	 linear::Sym3
+	 covariance () const
+	 {
+	    linear::Sym3 c = scatter;
+	    if (count > 0)
+	       c *= 1.0 / double(count);
+	    return c;
+	 }
+   };
+
+   // A Box_tree whose nodes carry the Moments of their points, so that
+   // the moments of the points in a ball or a box are obtained by
+   // adding the moments of the nodes it contains, in O(1) each, and
+   // only testing points in the leaves that cross its boundary. Only
+   // the first three coordinates are accumulated; the boxes use all
+   // of them.
+   class Moment_tree
+   {
+	 Box_tree _tree;
+	 std::vector<Moments> _moments;
+	 size_t _mdim;
+
+	 void
+	 _init ()
+	 {
+	    _mdim = std::min(_tree.dim(), size_t(3));
+	    _moments.assign(_tree.num_nodes(), Moments());
+
+	    // children come after their parent
+	    for (size_t n = _tree.num_nodes(); n-- > 0;)
+	    {
+	       const Box_tree::Node &node = _tree.node(n);
+	       if (_tree.is_leaf(n))
+		  for (size_t i = node.begin; i < node.end; ++i)
+		     _moments[n].add(_tree.point(i), _mdim);
+	       else
+	       {
+		  _moments[n] = _moments[node.left];
+		  _moments[n].add(_moments[node.right]);
+	       }
+	    }
+	 }
+
+	 bool
+	 _in_box (const double *p, const double *lo, const double *hi) const
+	 {
+	    for (size_t d = 0; d < _tree.dim(); ++d)
+	       if (p[d] < lo[d] || p[d] > hi[d])
+		  return false;
+	    return true;
+	 }
+
+      public:
+	 Moment_tree (const KD_tree &kd, size_t leaf_size = 16) :
+	    _tree(kd, leaf_size)
+	 {
+	    _init();
+	 }
+
+	 Moment_tree (const Data_cloud &c, size_t leaf_size = 16) :
+	    _tree(c, leaf_size)
+	 {
+	    _init();
+	 }
+
+	 const Box_tree &
+	 tree () const
+	 {
+	    return _tree;
+	 }
+
+	 size_t size () const
+	 {
+	    return _tree.size();
+	 }
+
+	 // Moments of the points at distance at most r from q. With
+	 // eps > 0, nodes lying within (1 + eps) r are taken as a whole,
+	 // so that points up to that distance may be counted as well.
+	 void
+	 ball_moments (const double *q, double r, Moments &m,
+		       double eps = 0.0) const
+	 {
+	    m = Moments();
+	    if (_tree.num_nodes() == 0)
+	       return;
+
+	    const double r2 = r * r;
+	    const double R2 = r2 * (1.0 + eps) * (1.0 + eps);
+	    size_t stack[64], top = 0;
+	    stack[top++] = 0;
+	    while (top > 0)
+	    {
+	       const size_t n = stack[--top];
+	       double dmin2, dmax2;
+	       _tree.box_distances(n, q, dmin2, dmax2);
+	       if (dmin2 > r2)
+		  continue;
+
+	       const Box_tree::Node &node = _tree.node(n);
+	       if (dmax2 <= R2)
+		  m.add(_moments[n]);
+	       else if (_tree.is_leaf(n))
+	       {
+		  for (size_t i = node.begin; i < node.end; ++i)
+		  {
+		     const double *p = _tree.point(i);
+		     double d2 = 0.0;
+		     for (size_t d = 0; d < _tree.dim(); ++d)
+			d2 += (p[d] - q[d]) * (p[d] - q[d]);
+		     if (d2 <= r2)
+			m.add(p, _mdim);
+		  }
+	       }
+	       else
+	       {
+		  stack[top++] = node.right;
+		  stack[top++] = node.left;
+	       }
+	    }
+	 }
+
+	 // Moments of the points in the box [lo, hi]
+	 void
+	 box_moments (const double *lo, const double *hi, Moments &m) const
+	 {
+	    m = Moments();
+	    if (_tree.num_nodes() == 0)
+	       return;
+
+	    size_t stack[64], top = 0;
+	    stack[top++] = 0;
+	    while (top > 0)
+	    {
+	       const size_t n = stack[--top];
+	       const double *nlo = _tree.box_lo(n), *nhi = _tree.box_hi(n);
+	       bool disjoint = false, inside = true;
+	       for (size_t d = 0; d < _tree.dim(); ++d)
+	       {
+		  disjoint = disjoint || nhi[d] < lo[d] || nlo[d] > hi[d];
+		  inside = inside && nlo[d] >= lo[d] && nhi[d] <= hi[d];
+	       }
+	       if (disjoint)
+		  continue;
+
+	       const Box_tree::Node &node = _tree.node(n);
+	       if (inside)
+		  m.add(_moments[n]);
+	       else if (_tree.is_leaf(n))
+	       {
+		  for (size_t i = node.begin; i < node.end; ++i)
+		     if (_in_box(_tree.point(i), lo, hi))
+			m.add(_tree.point(i), _mdim);
+	       }
+	       else
+	       {
+		  stack[top++] = node.right;
+		  stack[top++] = node.left;
+	       }
+	    }
+	 }
+   };
+}
+
+#endif
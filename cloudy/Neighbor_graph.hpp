@@ -0,0 +1,271 @@
+#ifndef CLOUDY_NEIGHBOR_GRAPH_HPP
+#define CLOUDY_NEIGHBOR_GRAPH_HPP
+
+#include <cloudy/Cloud.hpp>
+#include <boost/cstdint.hpp>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+namespace cloudy
+{
+   // The neighbours of every point within the support of a kernel,
+   // with their kernel weights, in compressed sparse row form: the
+   // neighbours of point i are indices[offsets[i] .. offsets[i+1]).
+   // Building it costs one ball query per point; applying it is then
+   // a sparse matrix-vector product, which is what repeated
+   // convolutions with the same kernel boil down to. The graph
+   // records what it was built from (kernel name and radius, eps and a
+   // checksum of the coordinates), so that a cached graph can be
+   // checked against the current ones.
+   class Neighbor_graph
+   {
+	 std::vector<size_t> _offsets;
+	 std::vector<unsigned int> _indices;
+	 std::vector<double> _weights;
+	 double _radius;
+	 double _eps;
+	 boost::uint64_t _checksum;
+	 std::string _kernel;
+
+	 // rows are queried by blocks, each with its own buffers, and
+	 // concatenated in order afterwards
+	 struct Block
+	 {
+	       std::vector<size_t> counts;
+	       std::vector<unsigned int> indices;
+	       std::vector<double> weights;
+	 };
+
+	 static const size_t block_size = 1024;
+
+      public:
+	 Neighbor_graph() : _offsets(1, 0), _radius(0.0), _eps(0.0),
+			    _checksum(0)
+	 {}
+
+	 // The index is a KD_tree or a Grid_index; the function is a
+	 // Kernel_function.
+	 template <class Index, class Function>
+	 Neighbor_graph(const Index &index, const Function &f,
+			double eps = 0.0)
+	 {
+	    build(index, f, eps);
+	 }
+
+	 template <class Index, class Function>
+	 void
+	 build (const Index &index, const Function &f, double eps = 0.0)
+	 {
+	    const size_t n = index.size();
+	    _radius = f.support_radius();
+	    _eps = eps;
+	    _checksum = checksum(index);
+	    _kernel = f.name();
+
+	    std::vector<Block> blocks((n + block_size - 1) / block_size);
+
+#pragma omp parallel
+	    {
+	       std::vector<int> indices(64);
+	       std::vector<double> squared_distances(64);
+
+#pragma omp for schedule(dynamic)
+	       for (long b = 0; b < long(blocks.size()); ++b)
+	       {
+		  Block &block = blocks[b];
+		  const size_t end = std::min(n, (b + 1) * block_size);
+		  for (size_t i = b * block_size; i < end; ++i)
+		  {
+		     size_t k = index.find_points_in_ball
+			(index.coordinates(i), _radius,
+			 indices, squared_distances, eps);
+		     size_t count = 0;
+		     for (size_t j = 0; j < k; ++j)
+		     {
+			double w = f(squared_distances[j]);
+			if (w == 0.0)
+			   continue;
+			block.indices.push_back(indices[j]);
+			block.weights.push_back(w);
+			++count;
+		     }
+		     block.counts.push_back(count);
+		  }
+	       }
+	    }
+
+	    _offsets.resize(n + 1);
+	    _offsets[0] = 0;
+	    size_t i = 0;
+	    for (size_t b = 0; b < blocks.size(); ++b)
+	       for (size_t j = 0; j < blocks[b].counts.size(); ++j, ++i)
+		  _offsets[i + 1] = _offsets[i] + blocks[b].counts[j];
+
+	    _indices.resize(_offsets[n]);
+	    _weights.resize(_offsets[n]);
+
+#pragma omp parallel for schedule(dynamic)
+	    for (long b = 0; b < long(blocks.size()); ++b)
+	    {
+	       const size_t first = _offsets[b * block_size];
+	       std::copy(blocks[b].indices.begin(), blocks[b].indices.end(),
+			 _indices.begin() + first);
+	       std::copy(blocks[b].weights.begin(), blocks[b].weights.end(),
+			 _weights.begin() + first);
+	       blocks[b] = Block();
+	    }
+	 }
+
+	 size_t
+	 size() const
+	 {
+	    return _offsets.size() - 1;
+	 }
+
+	 // number of stored (point, neighbour) pairs
+	 size_t
+	 num_edges() const
+	 {
+	    return _indices.size();
+	 }
+
+	 double
+	 radius() const
+	 {
+	    return _radius;
+	 }
+
+	 double
+	 eps() const
+	 {
+	    return _eps;
+	 }
+
+	 boost::uint64_t
+	 checksum() const
+	 {
+	    return _checksum;
+	 }
+
+	 const std::string &
+	 kernel() const
+	 {
+	    return _kernel;
+	 }
+
+	 // FNV-1a hash of the coordinates of the points of an index, in
+	 // the order of their indices
+	 template <class Index>
+	 static boost::uint64_t
+	 checksum (const Index &index)
+	 {
+	    boost::uint64_t h = 14695981039346656037ULL;
+	    for (size_t i = 0; i < index.size(); ++i)
+	    {
+	       const unsigned char *c = reinterpret_cast<const unsigned char *>
+		  (index.coordinates(i));
+	       for (size_t b = 0; b < index.dim() * sizeof(double); ++b)
+	       {
+		  h ^= c[b];
+		  h *= 1099511628211ULL;
+	       }
+	    }
+	    return h;
+	 }
+
+	 // out = W in, for a field of C components per point stored
+	 // contiguously
+	 void
+	 multiply (const std::vector<double> &in, size_t C,
+		   std::vector<double> &out) const
+	 {
+	    assert (in.size() == size() * C);
+	    out.resize(in.size());
+
+#pragma omp parallel for schedule(dynamic, 256)
+	    for (long i = 0; i < long(size()); ++i)
+	    {
+	       double *o = &out[C * i];
+	       std::fill(o, o + C, 0.0);
+	       for (size_t e = _offsets[i]; e < _offsets[i + 1]; ++e)
+	       {
+		  const double w = _weights[e];
+		  const double *v = &in[C * _indices[e]];
+		  for (size_t c = 0; c < C; ++c)
+		     o[c] += w * v[c];
+	       }
+	    }
+	 }
+
+	 // Binary serialization; the layout is that of the machine.
+	 // load() returns false if the stream does not hold a graph.
+	 void
+	 save (std::ostream &os) const
+	 {
+	    const char magic[4] = {'C', 'N', 'G', '2'};
+	    size_t n = size(), m = num_edges(), l = _kernel.size();
+	    os.write(magic, 4);
+	    os.write(reinterpret_cast<const char *>(&n), sizeof(n));
+	    os.write(reinterpret_cast<const char *>(&m), sizeof(m));
+	    os.write(reinterpret_cast<const char *>(&_radius), sizeof(_radius));
+	    os.write(reinterpret_cast<const char *>(&_eps), sizeof(_eps));
+	    os.write(reinterpret_cast<const char *>(&_checksum),
+		     sizeof(_checksum));
+	    os.write(reinterpret_cast<const char *>(&l), sizeof(l));
+	    os.write(_kernel.data(), l);
+	    os.write(reinterpret_cast<const char *>(&_offsets.front()),
+		     (n + 1) * sizeof(size_t));
+	    if (m > 0)
+	    {
+	       os.write(reinterpret_cast<const char *>(&_indices.front()),
+			m * sizeof(unsigned int));
+	       os.write(reinterpret_cast<const char *>(&_weights.front()),
+			m * sizeof(double));
+	    }
+	 }
+
+	 bool
+	 load (std::istream &is)
+	 {
+	    char magic[4], name[256];
+	    size_t n, m, l;
+	    if (!is.read(magic, 4) ||
+		std::string(magic, 4) != "CNG2" ||
+		!is.read(reinterpret_cast<char *>(&n), sizeof(n)) ||
+		!is.read(reinterpret_cast<char *>(&m), sizeof(m)) ||
+		!is.read(reinterpret_cast<char *>(&_radius), sizeof(_radius)) ||
+		!is.read(reinterpret_cast<char *>(&_eps), sizeof(_eps)) ||
+		!is.read(reinterpret_cast<char *>(&_checksum),
+			 sizeof(_checksum)) ||
+		!is.read(reinterpret_cast<char *>(&l), sizeof(l)) ||
+		l > sizeof(name) || !is.read(name, l))
+	    {
+	       *this = Neighbor_graph();
+	       return false;
+	    }
+	    _kernel.assign(name, l);
+
+	    _offsets.resize(n + 1);
+	    _indices.resize(m);
+	    _weights.resize(m);
+	    is.read(reinterpret_cast<char *>(&_offsets.front()),
+		    (n + 1) * sizeof(size_t));
+	    if (m > 0)
+	    {
+	       is.read(reinterpret_cast<char *>(&_indices.front()),
+		       m * sizeof(unsigned int));
+	       is.read(reinterpret_cast<char *>(&_weights.front()),
+		       m * sizeof(double));
+	    }
+	    if (!is || _offsets[n] != m)
+	    {
+	       *this = Neighbor_graph();
+	       return false;
+	    }
+	    return true;
+	 }
+   };
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef CLOUDY_WITNESSED_DISTANCE_HPP
+#define CLOUDY_WITNESSED_DISTANCE_HPP
+
+#include <cloudy/Cloud.hpp>
+#include <cloudy/KD_tree.hpp>
+#include <algorithm>
+#include <math.h>
+
+namespace cloudy
+{
+   // Witnessed distance to a measure (Guibas, Merigot, Morozov).
+   //
+   // A witness is the barycenter b of the mass-m neighbourhood S of
+   // a cloud point, together with the variance s of S around b. For
+   // every query x, the mean squared distance from x to S is the
+   // power distance |x - b|^2 + s, so the minimum of these over all
+   // witnesses bounds the distance to the measure from above. Taking
+   // as witness the cloud point p nearest to x, one gets
+   //
+   //     d(x) <= d_w(x) <= |x - p| + d(p) <= 2|x - p| + d(x) <= 3 d(x)
+   //
+   // since d is 1-Lipschitz and |x - p| <= d(x).
+   //
+   // The witnesses are lifted to (b, sqrt(s)) in dimension d+1, so
+   // that the power distance to the query is the squared euclidean
+   // distance to (x, 0): a single nearest neighbour query answers.
+   class Witnessed_distance
+   {
+	 KD_tree _kd;
+	 size_t _dim;
+
+	 // rows of the input: barycenter, then variance
+	 static Data_cloud
+	 _lift (const Data_cloud &witnesses)
+	 {
+	    Data_cloud lifted(witnesses.size());
+	    for (size_t i = 0; i < witnesses.size(); ++i)
+	    {
+	       lifted[i] = witnesses[i];
+	       size_t d = lifted[i].size() - 1;
+	       lifted[i][d] = sqrt(std::max(lifted[i][d], 0.0));
+	    }
+	    return lifted;
+	 }
+
+      public:
+	 Witnessed_distance (const Data_cloud &witnesses) :
+	    _kd(_lift(witnesses)), _dim(witnesses[0].size() - 1)
+	 {}
+
+	 const KD_tree &
+	 tree () const
+	 {
+	    return _kd;
+	 }
+
+	 size_t dim() const
+	 {
+	    return _dim;
+	 }
+
+	 // Squared witnessed distance at x. The iterator must have been
+	 // built on tree(); query is a scratch vector.
+	 double
+	 squared_distance (const uvector &x,
+			   KD_tree::Nearest_neighbor_iterator &nn,
+			   uvector &query) const
+	 {
+	    assert (x.size() == _dim);
+	    query.resize(_dim + 1);
+	    std::copy(x.begin(), x.end(), query.begin());
+	    query[_dim] = 0.0;
+
+	    size_t idx;
+	    double sqd;
+	    nn.start(query);
+	    if (!nn.next(idx, sqd))
+	       return 0.0;
+	    return sqd;
+	 }
+
+	 double
+	 operator () (const uvector &x) const
+	 {
+	    KD_tree::Nearest_neighbor_iterator nn(_kd);
+	    uvector query(_dim + 1);
+	    return squared_distance(x, nn, query);
+	 }
+   };
+
+   // The witness of a cloud point p, given the barycenter b and the
+   // squared distance h to the measure at p: the variance of the
+   // neighbourhood around b is h - |p - b|^2.
+   inline uvector
+   witness (const uvector &p, const uvector &bary, double h)
+   {
+      uvector w(bary.size() + 1);
+      std::copy(bary.begin(), bary.end(), w.begin());
+      w[bary.size()] = std::max(h - ublas::inner_prod(p - bary, p - bary), 0.0);
+      return w;
+   }
+}
+
+#endif
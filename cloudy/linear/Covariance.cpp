@@ -1,4 +1,5 @@
 #include <cloudy/linear/Covariance.hpp>
+#include <cloudy/linear/Symmetric_eigen_3.hpp>
 #include <CGAL/linear_least_squares_fitting_3.h>
 
 
@@ -11,8 +12,8 @@ namespace cloudy
    namespace linear
    {
 #ifdef CLOUDY_USE_LAPACK
-      bool
-      covariance_extract_eigen(const umatrix &m, 
+      static bool
+      general_extract_eigen(const umatrix &m, 
                                std::vector<double> &eig,
                                Data_cloud &directions)
       {
@@ -32,8 +33,8 @@ namespace cloudy
       }
 
 #else
-      bool
-      covariance_extract_eigen(const umatrix &m, 
+      static bool
+      general_extract_eigen(const umatrix &m, 
 			       std::vector<double> &eig,
 			       Data_cloud &directions)
       {
@@ -72,6 +73,120 @@ namespace cloudy
       }
 #endif
 
+      void
+      covariance_extract_eigen(const Sym3 &m, Vec3 &eig, Mat3 &directions)
+      {
+	 symmetric_eigen_3(m.begin(), eig.begin(), directions.data());
+      }
+
+      static bool
+      extract_eigen_3(const Sym3 &m,
+		      std::vector<double> &eig,
+		      Data_cloud &directions)
+      {
+	 Vec3 values;
+	 Mat3 vectors;
+	 covariance_extract_eigen(m, values, vectors);
+
+	 directions.resize(3);
+	 for (size_t i = 0; i < 3; ++i)
+	 {
+	    eig.push_back(values[i]);
+	    directions[i] = to_uvector(vectors.row(i));
+	 }
+	 return true;
+      }
+
+      // 3x3 matrices do not go through LAPACK, whose call overhead
+      // dominates at this size
+      bool
+      covariance_extract_eigen(const umatrix &m, 
+                               std::vector<double> &eig,
+                               Data_cloud &directions)
+      {
+	 if (m.size1() != 3)
+	    return general_extract_eigen(m, eig, directions);
+
+	 Sym3 c;
+	 for (size_t i = 0; i < 3; ++i)
+	    for (size_t j = i; j < 3; ++j)
+	       c(i,j) = m(i,j);
+	 return extract_eigen_3(c, eig, directions);
+      }
+
+      bool
+      covariance_extract_eigen_3(const uvector &v, 
+                                 std::vector<double> &eig,
+                                 Data_cloud &directions)
+      {
+	 return extract_eigen_3(Sym3(v), eig, directions);
+      }
+
+      void
+      covariance_diagonalize_3(const std::vector<double> &covariances,
+			       std::vector<double> &values,
+			       std::vector<double> &vectors,
+			       bool descending)
+      {
+	 const long W = 8;
+	 const size_t n = covariances.size() / 6;
+	 values.resize(3 * n);
+	 vectors.resize(9 * n);
+
+#pragma omp parallel for schedule(static)
+	 for (long b = 0; b < long((n + W - 1) / W); ++b)
+	 {
+	    // the last block is padded with identity matrices
+	    static const double identity[6] = {1, 0, 0, 1, 0, 1};
+	    double m[6][W], eig[3][W], vec[3][3][W];
+	    for (long l = 0; l < W; ++l)
+	    {
+	       const size_t i = b * W + l;
+	       for (size_t c = 0; c < 6; ++c)
+		  m[c][l] = (i < n) ? covariances[6 * i + c] : identity[c];
+	    }
+
+	    symmetric_eigen_3_block<W>(m, eig, vec, descending);
+
+	    for (long l = 0; l < W && size_t(b * W + l) < n; ++l)
+	    {
+	       const size_t i = b * W + l;
+	       for (size_t j = 0; j < 3; ++j)
+	       {
+		  values[j * n + i] = eig[j][l];
+		  for (size_t k = 0; k < 3; ++k)
+		     vectors[(3 * j + k) * n + i] = vec[j][k][l];
+	       }
+	    }
+	 }
+      }
+
+      void
+      covariance_diagonalize_3(const Data_cloud &covariances,
+			       Data_cloud &first,
+			       Data_cloud &second,
+			       Data_cloud &third,
+			       std::vector<double> &anisotropy)
+      {
+	 const size_t n = covariances.size();
+	 std::vector<double> coefficients(6 * n), V, D;
+	 for (size_t i = 0; i < n; ++i)
+	    std::copy(covariances[i].begin(), covariances[i].begin() + 6,
+		      coefficients.begin() + 6 * i);
+	 covariance_diagonalize_3(coefficients, V, D);
+
+	 Data_cloud *directions[3] = {&first, &second, &third};
+	 for (size_t j = 0; j < 3; ++j)
+	 {
+	    directions[j]->resize(n, uvector(3));
+	    for (size_t i = 0; i < n; ++i)
+	       for (size_t k = 0; k < 3; ++k)
+		  (*directions[j])[i][k] = D[(3 * j + k) * n + i];
+	 }
+	 anisotropy.resize(n);
+	 for (size_t i = 0; i < n; ++i)
+	    anisotropy[i] = V[n + i] / (V[i] + V[n + i] + V[2 * n + i]);
+      }
 
       umatrix matrix_from_covariance_3(const uvector v)
       {
@@ -85,6 +200,13 @@ namespace cloudy
 	 return m;
       }
 
+     void
+     covariance_add_vector(Sym3 &m,
+			   const Vec3 &v)
+     {
+       m.add_outer(v);
+     }
+
      void
      covariance_add_vector(umatrix &m,
 			   const uvector &v)
@@ -97,56 +219,61 @@ namespace cloudy
      }
 
 
-      struct eigen
+      class Compare_eigenvalues
       {
-	    double value;
-	    uvector direction;
-	    
+	    const std::vector<double> &_eig;
+	    bool _descending;
+
 	 public:
-	    eigen (double v = 0.0, uvector d = ublas::zero_vector<double>())
-	       : value(v), direction(d) 
+	    Compare_eigenvalues(const std::vector<double> &eig,
+				bool descending) :
+	       _eig(eig), _descending(descending)
 	    {}
-      };
 
-      class decreasing_eigenvalues
-      {
-	 public:
-	    bool operator ()(const eigen &e1, const eigen &e2)
-	    {
-	       return e1.value > e2.value;
-	    }
-      };
-      
-      class increasing_eigenvalues
-      {
-	 public:
-	    bool operator ()(const eigen &e1, const eigen &e2)
+	    bool operator ()(size_t i, size_t j) const
 	    {
-	       return e1.value < e2.value;
+	       return _descending ? (_eig[i] > _eig[j]) : (_eig[i] < _eig[j]);
 	    }
       };
 
-
+      // the directions are moved by swapping, not copied
       void 
       covariance_sort_eigen(std::vector<double> &eig,
                             Data_cloud &directions,
                             bool descending)
       {
-	 std::vector<eigen> eigs;
-	 
-	 for (size_t i = 0; i < eig.size(); ++i)
-	    eigs.push_back(eigen(eig[i], directions[i]));
+	 std::vector<size_t> order(eig.size());
+	 for (size_t i = 0; i < order.size(); ++i)
+	    order[i] = i;
+	 std::sort(order.begin(), order.end(),
+		   Compare_eigenvalues(eig, descending));
 
-	 if (descending)
-	    sort(eigs.begin(), eigs.end(), decreasing_eigenvalues());
-	 else
-	    sort(eigs.begin(), eigs.end(), increasing_eigenvalues());
-
-	 for (size_t i = 0; i < eig.size(); ++i)
+	 std::vector<double> sorted_eig(eig.size());
+	 Data_cloud sorted_directions(eig.size());
+	 for (size_t i = 0; i < order.size(); ++i)
 	 {
-	    eig[i] = eigs[i].value;
-	    directions[i] = eigs[i].direction;
+	    sorted_eig[i] = eig[order[i]];
+	    sorted_directions[i].swap(directions[order[i]]);
 	 }
+	 eig.swap(sorted_eig);
+	 directions.swap(sorted_directions);
+      }
+
+      void
+      covariance_sort_eigen(Vec3 &eig, Mat3 &directions, bool descending)
+      {
+	 // insertion sort of the three eigenpairs
+	 for (size_t i = 1; i < 3; ++i)
+	    for (size_t j = i; j > 0; --j)
+	    {
+	       const bool swap = descending ? (eig[j - 1] < eig[j])
+		  : (eig[j - 1] > eig[j]);
+	       if (!swap)
+		  break;
+	       std::swap(eig[j - 1], eig[j]);
+	       for (size_t k = 0; k < 3; ++k)
+		  std::swap(directions(j - 1, k), directions(j, k));
+	    }
       }
    }
 }
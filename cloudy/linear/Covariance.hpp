@@ -2,6 +2,7 @@
 #define CLOUDY_COVARIANCE_HPP
 
 #include <cloudy/linear/Linear.hpp>
+#include <cloudy/linear/Matrix_3.hpp>
 #include <cloudy/Cloud.hpp>
 
 namespace cloudy
@@ -14,7 +15,38 @@ namespace cloudy
       covariance_extract_eigen(const umatrix &m, 
                                std::vector<double> &eig,
                                Data_cloud &directions);
+
+      // same as covariance_extract_eigen(matrix_from_covariance_3(v)),
+      // without building the matrix
+      bool
+      covariance_extract_eigen_3(const uvector &v, 
+                                 std::vector<double> &eig,
+                                 Data_cloud &directions);
       
+      // Diagonalizes the n 3x3 covariance matrices stored as six
+      // coefficients each (m11 m12 m13 m22 m23 m33) in covariances,
+      // by blocks of matrices processed in lockstep and in parallel.
+      // The results are stored by component, for all the matrices:
+      // eigenvalue j of matrix i is values[j*n + i], and coordinate k
+      // of its unit eigenvector is vectors[(3*j + k)*n + i]. The
+      // eigenvalues are sorted, as by covariance_sort_eigen.
+      void
+      covariance_diagonalize_3(const std::vector<double> &covariances,
+			       std::vector<double> &values,
+			       std::vector<double> &vectors,
+			       bool descending = true);
+
+      // Same, for covariance vectors as read from a .p file: the
+      // eigenvectors of the matrices, by decreasing eigenvalue, go
+      // to first, second and third, and the anisotropy of matrix i
+      // is its middle eigenvalue over the sum of the three.
+      void
+      covariance_diagonalize_3(const Data_cloud &covariances,
+			       Data_cloud &first,
+			       Data_cloud &second,
+			       Data_cloud &third,
+			       std::vector<double> &anisotropy);
+
       void 
       covariance_sort_eigen(std::vector<double> &eig,
                             Data_cloud &directions,
@@ -23,6 +55,19 @@ namespace cloudy
      void
      covariance_add_vector(umatrix &m,
 			   const uvector &v);
+
+      // Fixed-size versions, which do not allocate. The rows of
+      // directions are the unit eigenvectors, and the eigenvalues are
+      // in increasing order before sorting.
+      void
+      covariance_extract_eigen(const Sym3 &m, Vec3 &eig, Mat3 &directions);
+
+      void
+      covariance_sort_eigen(Vec3 &eig, Mat3 &directions,
+			    bool descending = true);
+
+      void
+      covariance_add_vector(Sym3 &m, const Vec3 &v);
    }
 }
 
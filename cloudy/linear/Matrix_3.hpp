@@ -0,0 +1,205 @@
+#ifndef CLOUDY_LINEAR_MATRIX_3_HPP
+#define CLOUDY_LINEAR_MATRIX_3_HPP
+
+#include <cloudy/linear/Linear.hpp>
+#include <algorithm>
+#include <iostream>
+
+namespace cloudy
+{
+   namespace linear
+   {
+      // Fixed-size vector and matrices of dimension 3, stored in place,
+      // for the per-point computations where a uvector or a umatrix
+      // would cost a heap allocation. They convert explicitly from and
+      // to uvector.
+
+      class Vec3
+      {
+	    double _x[3];
+
+	 public:
+	    Vec3 (double x = 0.0, double y = 0.0, double z = 0.0)
+	    {
+	       _x[0] = x; _x[1] = y; _x[2] = z;
+	    }
+
+	    explicit Vec3 (const uvector &v)
+	    {
+	       std::copy(v.begin(), v.begin() + 3, _x);
+	    }
+
+	    static size_t size () { return 3; }
+
+	    double &operator [] (size_t i) { return _x[i]; }
+	    const double &operator [] (size_t i) const { return _x[i]; }
+
+	    double *begin () { return _x; }
+	    double *end () { return _x + 3; }
+	    const double *begin () const { return _x; }
+	    const double *end () const { return _x + 3; }
+
+	    Vec3 &operator += (const Vec3 &v)
+	    {
+	       _x[0] += v._x[0]; _x[1] += v._x[1]; _x[2] += v._x[2];
+	       return *this;
+	    }
+
+	    Vec3 &operator -= (const Vec3 &v)
+	    {
+	       _x[0] -= v._x[0]; _x[1] -= v._x[1]; _x[2] -= v._x[2];
+	       return *this;
+	    }
+
+	    Vec3 &operator *= (double s)
+	    {
+	       _x[0] *= s; _x[1] *= s; _x[2] *= s;
+	       return *this;
+	    }
+      };
+
+      inline Vec3 operator + (Vec3 a, const Vec3 &b) { return a += b; }
+      inline Vec3 operator - (Vec3 a, const Vec3 &b) { return a -= b; }
+      inline Vec3 operator * (double s, Vec3 a) { return a *= s; }
+
+      inline double
+      inner_prod (const Vec3 &a, const Vec3 &b)
+      {
+	 return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+      }
+
+      // General 3x3 matrix, row-major
+      class Mat3
+      {
+	    double _m[3][3];
+
+	 public:
+	    Mat3 ()
+	    {
+	       std::fill(&_m[0][0], &_m[0][0] + 9, 0.0);
+	    }
+
+	    double &operator () (size_t i, size_t j) { return _m[i][j]; }
+	    const double &operator () (size_t i, size_t j) const
+	    {
+	       return _m[i][j];
+	    }
+
+	    Vec3 row (size_t i) const
+	    {
+	       return Vec3(_m[i][0], _m[i][1], _m[i][2]);
+	    }
+
+	    void set_row (size_t i, const Vec3 &v)
+	    {
+	       std::copy(v.begin(), v.end(), _m[i]);
+	    }
+
+	    double (*data ())[3] { return _m; }
+	    const double (*data () const)[3] { return _m; }
+      };
+
+      // Symmetric 3x3 matrix, stored as its upper triangle
+      // M11 M12 M13 M22 M23 M33: the layout of covariance vectors in
+      // .p files. operator[] gives the coefficients in this order.
+      class Sym3
+      {
+	    double _m[6];
+
+	    static size_t index (size_t i, size_t j)
+	    {
+	       static const size_t idx[3][3] = {{0, 1, 2},
+						{1, 3, 4},
+						{2, 4, 5}};
+	       return idx[i][j];
+	    }
+
+	 public:
+	    Sym3 ()
+	    {
+	       std::fill(_m, _m + 6, 0.0);
+	    }
+
+	    explicit Sym3 (const uvector &v)
+	    {
+	       std::copy(v.begin(), v.begin() + 6, _m);
+	    }
+
+	    static size_t size () { return 6; }
+
+	    double &operator [] (size_t i) { return _m[i]; }
+	    const double &operator [] (size_t i) const { return _m[i]; }
+
+	    double &operator () (size_t i, size_t j) { return _m[index(i,j)]; }
+	    const double &operator () (size_t i, size_t j) const
+	    {
+	       return _m[index(i,j)];
+	    }
+
+	    double *begin () { return _m; }
+	    double *end () { return _m + 6; }
+	    const double *begin () const { return _m; }
+	    const double *end () const { return _m + 6; }
+
+	    Sym3 &operator += (const Sym3 &s)
+	    {
+	       for (size_t i = 0; i < 6; ++i)
+		  _m[i] += s._m[i];
+	       return *this;
+	    }
+
+	    Sym3 &operator *= (double s)
+	    {
+	       for (size_t i = 0; i < 6; ++i)
+		  _m[i] *= s;
+	       return *this;
+	    }
+
+	    // this += w v v^t
+	    void add_outer (const Vec3 &v, double w = 1.0)
+	    {
+	       _m[0] += w * v[0] * v[0];
+	       _m[1] += w * v[0] * v[1];
+	       _m[2] += w * v[0] * v[2];
+	       _m[3] += w * v[1] * v[1];
+	       _m[4] += w * v[1] * v[2];
+	       _m[5] += w * v[2] * v[2];
+	    }
+
+	    Mat3 full () const
+	    {
+	       Mat3 m;
+	       for (size_t i = 0; i < 3; ++i)
+		  for (size_t j = 0; j < 3; ++j)
+		     m(i,j) = (*this)(i,j);
+	       return m;
+	    }
+      };
+
+      inline uvector
+      to_uvector (const Vec3 &v)
+      {
+	 uvector u(3);
+	 std::copy(v.begin(), v.end(), u.begin());
+	 return u;
+      }
+
+      inline uvector
+      to_uvector (const Sym3 &s)
+      {
+	 uvector u(6);
+	 std::copy(s.begin(), s.end(), u.begin());
+	 return u;
+      }
+
+      inline std::ostream &
+      operator << (std::ostream &os, const Sym3 &s)
+      {
+	 for (size_t i = 0; i < 6; ++i)
+	    os << s[i] << " ";
+	 return os;
+      }
+   }
+}
+
+#endif
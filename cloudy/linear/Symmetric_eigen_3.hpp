@@ -0,0 +1,203 @@
+#ifndef CLOUDY_LINEAR_SYMMETRIC_EIGEN_3_HPP
+#define CLOUDY_LINEAR_SYMMETRIC_EIGEN_3_HPP
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+namespace cloudy
+{
+   namespace linear
+   {
+      // Eigen decomposition of the symmetric 3x3 matrix whose upper
+      // triangle is m = (m11 m12 m13 m22 m23 m33), by cyclic Jacobi
+      // rotations, without any allocation. As with LAPACK's syev, the
+      // eigenvalues are in increasing order, and vectors[i] is the
+      // unit eigenvector of eig[i]. Jacobi is accurate to the machine
+      // precision even for nearly equal eigenvalues, and converges in
+      // a handful of sweeps.
+      inline void
+      symmetric_eigen_3 (const double m[6], double eig[3],
+			 double vectors[3][3])
+      {
+	 double a[3][3] = {{m[0], m[1], m[2]},
+			   {m[1], m[3], m[4]},
+			   {m[2], m[4], m[5]}};
+	 double v[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+
+	 for (int sweep = 0; sweep < 32; ++sweep)
+	 {
+	    const double off = a[0][1] * a[0][1] + a[0][2] * a[0][2] +
+	       a[1][2] * a[1][2];
+	    const double diag = a[0][0] * a[0][0] + a[1][1] * a[1][1] +
+	       a[2][2] * a[2][2];
+	    if (off <= 1e-32 * diag || off == 0.0)
+	       break;
+
+	    for (int p = 0; p < 2; ++p)
+	       for (int q = p + 1; q < 3; ++q)
+	       {
+		  if (a[p][q] == 0.0)
+		     continue;
+
+		  // rotation in the (p, q) plane that cancels a[p][q]
+		  const double theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+		  const double t = (theta >= 0.0 ? 1.0 : -1.0) /
+		     (fabs(theta) + sqrt(theta * theta + 1.0));
+		  const double c = 1.0 / sqrt(t * t + 1.0), s = t * c;
+
+		  for (int k = 0; k < 3; ++k)
+		  {
+		     const double akp = a[k][p], akq = a[k][q];
+		     a[k][p] = c * akp - s * akq;
+		     a[k][q] = s * akp + c * akq;
+		  }
+		  for (int k = 0; k < 3; ++k)
+		  {
+		     const double apk = a[p][k], aqk = a[q][k];
+		     a[p][k] = c * apk - s * aqk;
+		     a[q][k] = s * apk + c * aqk;
+		  }
+		  for (int k = 0; k < 3; ++k)
+		  {
+		     const double vkp = v[k][p], vkq = v[k][q];
+		     v[k][p] = c * vkp - s * vkq;
+		     v[k][q] = s * vkp + c * vkq;
+		  }
+	       }
+	 }
+
+	 // the eigenvectors are the columns of v; sort by eigenvalue
+	 int order[3] = {0, 1, 2};
+	 for (int i = 1; i < 3; ++i)
+	    for (int j = i; j > 0 && a[order[j]][order[j]] <
+		    a[order[j - 1]][order[j - 1]]; --j)
+	    {
+	       const int tmp = order[j];
+	       order[j] = order[j - 1];
+	       order[j - 1] = tmp;
+	    }
+
+	 for (int i = 0; i < 3; ++i)
+	 {
+	    eig[i] = a[order[i]][order[i]];
+	    for (int k = 0; k < 3; ++k)
+	       vectors[i][k] = v[k][order[i]];
+	 }
+      }
+
+      // One Jacobi rotation of symmetric_eigen_3_block, cancelling the
+      // coefficient (P, Q), stored at a[PQ]; the coefficients between
+      // the third index R and P, Q are at a[RP], a[RQ]. The indices
+      // are template parameters so that the loop over the lanes has
+      // no aliasing between them.
+      template <int W, int P, int Q, int PQ, int RP, int RQ>
+      inline void
+      jacobi_rotate_block (double a[6][W], double v[3][3][W])
+      {
+	 for (int l = 0; l < W; ++l)
+	 {
+	    // t = tan of the angle, from d = a[Q][Q] - a[P][P]
+	    const double apq = a[PQ][l];
+	    const double d = a[Q][l] - a[P][l];
+	    const double den = fabs(d) + sqrt(d * d + 4.0 * apq * apq);
+	    const double num = 2.0 * apq * copysign(1.0, d);
+	    // den is 0 only when num is
+	    const double t = num / std::max(den, DBL_MIN);
+	    const double c = 1.0 / sqrt(t * t + 1.0), s = t * c;
+
+	    a[P][l] -= t * apq;
+	    a[Q][l] += t * apq;
+	    a[PQ][l] = 0.0;
+	    const double arp = a[RP][l], arq = a[RQ][l];
+	    a[RP][l] = c * arp - s * arq;
+	    a[RQ][l] = s * arp + c * arq;
+
+	    for (int i = 0; i < 3; ++i)
+	    {
+	       const double vip = v[i][P][l], viq = v[i][Q][l];
+	       v[i][P][l] = c * vip - s * viq;
+	       v[i][Q][l] = s * vip + c * viq;
+	    }
+	 }
+      }
+
+      // Same as symmetric_eigen_3, for W matrices at once, stored by
+      // coefficient: m[c][l] is coefficient c of matrix l. Every step
+      // is a loop over the W lanes without data-dependent branches,
+      // so that the compiler can vectorize it; the rotations use the
+      // form of the Jacobi angle that needs no test for a[p][q] == 0.
+      // The eigenvalues are sorted in increasing or decreasing order;
+      // eig[j][l] is eigenvalue j of matrix l, and vectors[j][k][l]
+      // component k of its eigenvector.
+      template <int W>
+      void
+      symmetric_eigen_3_block (const double m[6][W], double eig[3][W],
+			       double vectors[3][3][W], bool descending)
+      {
+	 // a[0..2] is the diagonal; a[3], a[4], a[5] are the
+	 // coefficients (0,1), (0,2), (1,2)
+	 double a[6][W], v[3][3][W];
+	 for (int l = 0; l < W; ++l)
+	 {
+	    a[0][l] = m[0][l]; a[1][l] = m[3][l]; a[2][l] = m[5][l];
+	    a[3][l] = m[1][l]; a[4][l] = m[2][l]; a[5][l] = m[4][l];
+	 }
+	 for (int i = 0; i < 3; ++i)
+	    for (int k = 0; k < 3; ++k)
+	       for (int l = 0; l < W; ++l)
+		  v[i][k][l] = (i == k) ? 1.0 : 0.0;
+
+	 for (int sweep = 0; sweep < 32; ++sweep)
+	 {
+	    int converged = 1;
+	    for (int l = 0; l < W; ++l)
+	    {
+	       const double off = a[3][l] * a[3][l] + a[4][l] * a[4][l] +
+		  a[5][l] * a[5][l];
+	       const double diag = a[0][l] * a[0][l] + a[1][l] * a[1][l] +
+		  a[2][l] * a[2][l];
+	       converged &= (off <= 1e-32 * diag || off == 0.0);
+	    }
+	    if (converged)
+	       break;
+
+	    jacobi_rotate_block<W, 0, 1, 3, 4, 5>(a, v);
+	    jacobi_rotate_block<W, 0, 2, 4, 3, 5>(a, v);
+	    jacobi_rotate_block<W, 1, 2, 5, 3, 4>(a, v);
+	 }
+
+	 // v[i][j] is component i of eigenvector j
+	 for (int j = 0; j < 3; ++j)
+	    for (int l = 0; l < W; ++l)
+	    {
+	       eig[j][l] = a[j][l];
+	       for (int i = 0; i < 3; ++i)
+		  vectors[j][i][l] = v[i][j][l];
+	    }
+
+	 // sorting network on the three eigenpairs
+	 static const int pairs[3][2] = {{0, 1}, {1, 2}, {0, 1}};
+	 for (int k = 0; k < 3; ++k)
+	 {
+	    const int i = pairs[k][0], j = pairs[k][1];
+	    for (int l = 0; l < W; ++l)
+	    {
+	       const bool swap = descending ? (eig[i][l] < eig[j][l])
+		  : (eig[i][l] > eig[j][l]);
+	       const double ei = eig[i][l], ej = eig[j][l];
+	       eig[i][l] = swap ? ej : ei;
+	       eig[j][l] = swap ? ei : ej;
+	       for (int c = 0; c < 3; ++c)
+	       {
+		  const double vi = vectors[i][c][l], vj = vectors[j][c][l];
+		  vectors[i][c][l] = swap ? vj : vi;
+		  vectors[j][c][l] = swap ? vi : vj;
+	       }
+	    }
+	 }
+      }
+   }
+}
+
+#endif
@@ -56,25 +56,24 @@ namespace cloudy
 	       >> ea;
 	 lfrom >> blend >> type;
 
-	 
-	 std::cerr << "Gradient Begin " << 
-	   c._start << " End " <<  c._end  
-		   << " SC " <<  c._start_color._r << " " <<
-	   c._start_color._g << " " << c._start_color._b
-		   <<  " EC " <<  c._end_color._r << " " <<
-	   c._end_color._g << " " <<  c._end_color._b
-		   << "\n";
-	 
 	 _gradient_colors.push_back(c);
       }
       
       std::sort(_gradient_colors.begin(), _gradient_colors.end());
+      build_table();
 
       return true;
    }
    
+   const size_t Gradient::table_size;
+
+   Gradient::Gradient ()
+   {
+      build_table();
+   }
+
    Color
-   Gradient::operator ()(double t) const
+   Gradient::evaluate (double t) const
    {
       if (_gradient_colors.size() == 0)
 	 return Color(0.0, 0.0, 0.0);
@@ -88,14 +87,53 @@ namespace cloudy
 	    break;
 	 }
       }
-      //      std::cerr << " t = " << t << " P = " << P << "\n";
       
       const Gradient_color & c = _gradient_colors[P];
       t = std::max(std::min(t, c._end), c._start);
       double l = (t - c._start)/(c._end - c._start);
 
       return (1.0 - l) * c._start_color + l * c._end_color;
-   };
+   }
+
+   static unsigned char
+   to_byte (double c)
+   {
+      return (unsigned char) (std::max(0.0, std::min(c, 1.0)) * 255.0 + 0.5);
+   }
+
+   void
+   Gradient::build_table ()
+   {
+      _table.resize(table_size);
+      _table_rgb8.resize(3 * table_size);
+      for (size_t i = 0; i < table_size; ++i)
+      {
+	 const Color c = evaluate(double(i) / double(table_size - 1));
+	 _table[i] = c;
+	 _table_rgb8[3 * i + 0] = to_byte(c._r);
+	 _table_rgb8[3 * i + 1] = to_byte(c._g);
+	 _table_rgb8[3 * i + 2] = to_byte(c._b);
+      }
+   }
+
+   void
+   Gradient::map_rgb8 (const std::vector<double> &values,
+		       double minval, double maxval,
+		       std::vector<unsigned char> &rgb) const
+   {
+      const double scale = (maxval > minval) ? 1.0 / (maxval - minval) : 0.0;
+      rgb.resize(3 * values.size());
+
+#pragma omp parallel for
+      for (long i = 0; i < long(values.size()); ++i)
+      {
+	 const unsigned char *c =
+	    &_table_rgb8[3 * table_index((values[i] - minval) * scale)];
+	 rgb[3 * i + 0] = c[0];
+	 rgb[3 * i + 1] = c[1];
+	 rgb[3 * i + 2] = c[2];
+      }
+   }
 
    const Color Red(1.0, 0.0, 0.0), Green(0.0, 1.0, 0.0),
      Blue(0.0, 0.0, 1.0), Black(0.0, 0.0, 0.0),
@@ -4,6 +4,7 @@
 #include <istream>
 #include <vector>
 #include <string>
+#include <algorithm>
 
 namespace cloudy
 {
@@ -42,12 +43,42 @@ namespace cloudy
 	 };
 	 
 
+	 // number of entries of the colour table over [0, 1]
+	 static const size_t table_size = 4096;
+
       private:
 	 std::vector<Gradient_color> _gradient_colors;
 
+	 // the gradient sampled at table_size regular values of t, as
+	 // colours and as packed 8-bit RGB; rebuilt by read_ggr
+	 std::vector<Color> _table;
+	 std::vector<unsigned char> _table_rgb8;
+
+	 Color evaluate (double t) const;
+	 void build_table ();
+
+	 // nearest table entry; t is clamped to [0, 1] (NaN gives 0)
+	 static size_t table_index (double t)
+	 {
+	    const double c = std::max(0.0, std::min(t, 1.0));
+	    return size_t(c * double(table_size - 1) + 0.5);
+	 }
+
       public:
+	 Gradient ();
+
 	 bool read_ggr(std::istream &from);
-	 Color operator ()(double t) const;
+
+	 Color operator ()(double t) const
+	 {
+	    return _table[table_index(t)];
+	 }
+
+	 // Colours values, mapping [minval, maxval] to [0, 1], as three
+	 // bytes (r, g, b) per value.
+	 void map_rgb8 (const std::vector<double> &values,
+			double minval, double maxval,
+			std::vector<unsigned char> &rgb) const;
    };
 }
 #endif
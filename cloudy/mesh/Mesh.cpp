@@ -1,7 +1,9 @@
 #include <cloudy/mesh/Mesh.hpp>
 #include <cloudy/random/Random.hpp>
+#include <cloudy/misc/Morton.hpp>
 #include <string>
 #include <list>
+#include <algorithm>
 #include <sstream>
 #include <time.h>
 
@@ -139,9 +141,12 @@ namespace cloudy
       }
    }
 
-   void Mesh::write_off (std::ostream &os) const
+   void Mesh::write_off (std::ostream &os,
+			 const std::vector<unsigned char> &rgb) const
    {
-      if (_flags & MESH_COLOR)
+      assert(rgb.empty() || rgb.size() == 3 * _points.size());
+
+      if ((_flags & MESH_COLOR) || !rgb.empty())
 	 os << "C";
       if (_flags & MESH_NORMAL)
 	 os << "N";
@@ -161,7 +166,14 @@ namespace cloudy
 	       << " " << _normals[i](2);
 
 	 }
-	 if (_flags & MESH_COLOR)
+	 if (!rgb.empty())
+	 {
+	    os << " " << int(rgb[3 * i + 0])
+	       << " " << int(rgb[3 * i + 1])
+	       << " " << int(rgb[3 * i + 2])
+	       << " " << 255;
+	 }
+	 else if (_flags & MESH_COLOR)
 	 {
 	    os << " " << _colors[i]._r
 	       << " " << _colors[i]._g
@@ -274,6 +286,44 @@ namespace cloudy
   }
 
 
+   void
+   Mesh::morton_order (std::vector<size_t> &order) const
+   {
+     const size_t n = _points.size();
+     order.resize(n);
+     if (n == 0)
+       return;
+
+     // bounding box of the (at most) first three coordinates
+     const size_t dim = std::min(size_t(3), _points[0].size());
+     double lo[3] = {0, 0, 0}, hi[3] = {0, 0, 0};
+     for (size_t d = 0; d < dim; ++d)
+       lo[d] = hi[d] = _points[0][d];
+     for (size_t i = 1; i < n; ++i)
+       for (size_t d = 0; d < dim; ++d)
+	 {
+	   lo[d] = std::min(lo[d], _points[i][d]);
+	   hi[d] = std::max(hi[d], _points[i][d]);
+	 }
+
+     const double cells = double((1 << 21) - 1);
+     std::vector< std::pair<boost::uint64_t, size_t> > codes(n);
+     for (size_t i = 0; i < n; ++i)
+       {
+	 boost::uint64_t x[3] = {0, 0, 0};
+	 for (size_t d = 0; d < dim; ++d)
+	   if (hi[d] > lo[d])
+	     x[d] = boost::uint64_t((_points[i][d] - lo[d]) /
+				    (hi[d] - lo[d]) * cells);
+	 codes[i] = std::make_pair(misc::morton_encode_3(x[0], x[1], x[2]),
+				   i);
+       }
+     std::sort(codes.begin(), codes.end());
+
+     for (size_t i = 0; i < n; ++i)
+       order[i] = codes[i].second;
+   }
+
    void
    Mesh::simple_tesselate(double maxr)
    {
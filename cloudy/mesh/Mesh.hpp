@@ -2,6 +2,8 @@
 #define MESH_HPP
 
 #include <iostream>
+#include <algorithm>
+#include <vector>
 
 #include <cloudy/misc/Progress.hpp>
 #include <cloudy/Cloud.hpp>
@@ -36,7 +38,13 @@ namespace cloudy
 	 
       public:
 	 void read_off (std::istream &is);
-	 void write_off (std::ostream &os) const;
+
+	 // If rgb is not empty, it holds three bytes (r, g, b) per point,
+	 // as given by simple_colorize_rgb8, and is written instead of
+	 // the colours of the mesh.
+	 void write_off (std::ostream &os,
+			 const std::vector<unsigned char> &rgb
+			 = std::vector<unsigned char>()) const;
 	 
 	 void clear()
 	 {
@@ -104,31 +112,66 @@ namespace cloudy
 
 	 void uniform_sample(Data_cloud &cl, size_t N);
 
+	 // Indices of the points along a Morton (Z-order) curve over
+	 // their bounding box, so that consecutive points are close in
+	 // space.
+	 void morton_order (std::vector<size_t> &order) const;
+
+	 // values[i] = f(point i). The points are taken in Morton order,
+	 // by chunks distributed among the threads, so that the
+	 // successive queries of a thread hit the same part of the
+	 // spatial index. f must be safe to call concurrently.
 	 template <class Function>
-	 void simple_colorize (const Function &f, 
-			       const Gradient &g,
-			       bool zero_average = false)
+	 void evaluate (const Function &f, std::vector<double> &values) const
+	 {
+	    const size_t chunk = 1024;
+	    std::vector<size_t> order;
+	    morton_order(order);
+	    values.resize(_points.size());
+
+	    cloudy::misc::Progress_display progress
+	       ((_points.size() + chunk - 1) / chunk, std::cerr);
+
+#pragma omp parallel for schedule(dynamic)
+	    for (long c = 0; c < long((order.size() + chunk - 1) / chunk); ++c)
+	    {
+	       const size_t end = std::min(order.size(), (c + 1) * chunk);
+	       for (size_t j = c * chunk; j < end; ++j)
+		  values[order[j]] = f(_points[order[j]]);
+
+#pragma omp critical (progress)
+	       ++progress;
+	    }
+	 }
+
+	 // values[i] = f(point i), and the range mapped to the gradient
+	 template <class Function>
+	 void colorize_values (const Function &f,
+			       bool zero_average,
+			       std::vector<double> &values,
+			       double &minval, double &maxval) const
 	 {
-	    std::vector<double> values(_points.size());
-	    double minval(0), maxval(0);
-	    
 	    std::cerr << "Colorizing ... \n";
-	    cloudy::misc::Progress_display progress(_points.size(), std::cerr);
+	    evaluate(f, values);
+	    minval = maxval = 0.0;
+	    if (values.empty())
+	       return;
 
-	    for (size_t i = 0; i < _points.size(); ++i)
-	    { 
-	       double v =  f(_points[i]);
-	       values[i] = v;
-	       if (i == 0)
+	    minval = maxval = values[0];
+#pragma omp parallel
+	    {
+	       double lo = values[0], hi = values[0];
+#pragma omp for nowait
+	       for (long i = 0; i < long(values.size()); ++i)
 	       {
-		  minval = v;
-		  maxval = v;
+		  lo = std::min(lo, values[i]);
+		  hi = std::max(hi, values[i]);
+	       }
+#pragma omp critical (colorize_range)
+	       {
+		  minval = std::min(minval, lo);
+		  maxval = std::max(maxval, hi);
 	       }
-	       else if (v >= maxval)
-		 maxval = v;
-	       else if (v <= minval)
-		 minval = v;	       
-	       ++progress;
 	    }
 
 	    if (zero_average)
@@ -137,15 +180,42 @@ namespace cloudy
 		minval = - absmax;
 		maxval = + absmax;
 	      }
-	    
+	 }
+
+	 template <class Function>
+	 void simple_colorize (const Function &f, 
+			       const Gradient &g,
+			       bool zero_average = false)
+	 {
+	    std::vector<double> values;
+	    double minval, maxval;
+	    colorize_values(f, zero_average, values, minval, maxval);
+	    if (values.empty())
+	       return;
+
 	    set_flags(get_flags()|MESH_COLOR);
-	    for (size_t i = 0; i < _points.size(); ++i)
+#pragma omp parallel for
+	    for (long i = 0; i < long(_points.size()); ++i)
 	    {
 	       double t = (values[i] - minval) / (maxval - minval);
 	       _colors[i] = g(t);
 	    }
 	 }
 
+	 // Same as simple_colorize, but gives the colours as packed
+	 // 8-bit RGB, three bytes per point, for write_off.
+	 template <class Function>
+	 void simple_colorize_rgb8 (const Function &f,
+				    const Gradient &g,
+				    std::vector<unsigned char> &rgb,
+				    bool zero_average = false) const
+	 {
+	    std::vector<double> values;
+	    double minval, maxval;
+	    colorize_values(f, zero_average, values, minval, maxval);
+	    g.map_rgb8(values, minval, maxval, rgb);
+	 }
+
          void simple_tesselate(double maxr);
 
  	 void normalize (double radius)
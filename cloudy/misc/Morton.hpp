@@ -0,0 +1,94 @@
+#ifndef CLOUDY_MISC_MORTON_HPP
+#define CLOUDY_MISC_MORTON_HPP
+
+#include <boost/cstdint.hpp>
+
+namespace cloudy
+{
+  namespace misc
+  {
+    // Morton (Z-order) codes: the bits of the coordinates are
+    // interleaved, so that cells that are close in the code order are
+    // close in space. 2D codes take 16 bits per coordinate, 3D codes
+    // take 21 bits per coordinate.
+
+    inline boost::uint32_t
+    morton_spread_2 (boost::uint32_t x)
+    {
+      x &= 0x0000ffff;
+      x = (x | (x << 8)) & 0x00ff00ff;
+      x = (x | (x << 4)) & 0x0f0f0f0f;
+      x = (x | (x << 2)) & 0x33333333;
+      x = (x | (x << 1)) & 0x55555555;
+      return x;
+    }
+
+    inline boost::uint32_t
+    morton_compact_2 (boost::uint32_t x)
+    {
+      x &= 0x55555555;
+      x = (x | (x >> 1)) & 0x33333333;
+      x = (x | (x >> 2)) & 0x0f0f0f0f;
+      x = (x | (x >> 4)) & 0x00ff00ff;
+      x = (x | (x >> 8)) & 0x0000ffff;
+      return x;
+    }
+
+    inline boost::uint32_t
+    morton_encode_2 (boost::uint32_t x, boost::uint32_t y)
+    {
+      return morton_spread_2(x) | (morton_spread_2(y) << 1);
+    }
+
+    inline void
+    morton_decode_2 (boost::uint32_t code,
+		     boost::uint32_t &x, boost::uint32_t &y)
+    {
+      x = morton_compact_2(code);
+      y = morton_compact_2(code >> 1);
+    }
+
+    inline boost::uint64_t
+    morton_spread_3 (boost::uint64_t x)
+    {
+      x &= 0x1fffffULL;
+      x = (x | (x << 32)) & 0x001f00000000ffffULL;
+      x = (x | (x << 16)) & 0x001f0000ff0000ffULL;
+      x = (x | (x << 8))  & 0x100f00f00f00f00fULL;
+      x = (x | (x << 4))  & 0x10c30c30c30c30c3ULL;
+      x = (x | (x << 2))  & 0x1249249249249249ULL;
+      return x;
+    }
+
+    inline boost::uint64_t
+    morton_compact_3 (boost::uint64_t x)
+    {
+      x &= 0x1249249249249249ULL;
+      x = (x | (x >> 2))  & 0x10c30c30c30c30c3ULL;
+      x = (x | (x >> 4))  & 0x100f00f00f00f00fULL;
+      x = (x | (x >> 8))  & 0x001f0000ff0000ffULL;
+      x = (x | (x >> 16)) & 0x001f00000000ffffULL;
+      x = (x | (x >> 32)) & 0x1fffffULL;
+      return x;
+    }
+
+    inline boost::uint64_t
+    morton_encode_3 (boost::uint64_t x, boost::uint64_t y,
+		     boost::uint64_t z)
+    {
+      return morton_spread_3(x) | (morton_spread_3(y) << 1)
+	| (morton_spread_3(z) << 2);
+    }
+
+    inline void
+    morton_decode_3 (boost::uint64_t code, boost::uint64_t &x,
+		     boost::uint64_t &y, boost::uint64_t &z)
+    {
+      x = morton_compact_3(code);
+      y = morton_compact_3(code >> 1);
+      z = morton_compact_3(code >> 2);
+    }
+  }
+}
+
+#endif
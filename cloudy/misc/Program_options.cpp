@@ -94,6 +94,20 @@ namespace cloudy
 	 else return str;
       }
       
+      std::vector<double>
+      to_doubles (const std::string &str)
+      {
+	 std::vector<std::string> fields;
+	 std::vector<double> res;
+	 if (str.empty())
+	    return res;
+
+	 boost::split(fields, str, boost::is_any_of(","));
+	 for (size_t i = 0; i < fields.size(); ++i)
+	    res.push_back(to_double(fields[i]));
+	 return res;
+      }
+      
       std::string remove_extension(const std::string &str, char sep)
       {
 	 std::string r = str;
@@ -21,6 +21,8 @@ namespace cloudy
       unsigned to_unsigned (const std::string &str, unsigned def = 0);
                             std::string to_str(const std::string &str,
 		            const std::string &def = "");
+      // Comma-separated list of numbers, e.g. "-1,-1,-1,1,1,1".
+      std::vector<double> to_doubles (const std::string &str);
 
 //    void change_extension(const std::string &str, const std::string &newext);
 //    std::string remove_extension(const std::string &str, char sep='.');
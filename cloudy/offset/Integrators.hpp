@@ -3,6 +3,7 @@
 
 #include <cloudy/mesh/Mesh.hpp>
 #include <cloudy/linear/Linear.hpp>
+#include <cloudy/linear/Matrix_3.hpp>
 #include <math.h>
 
 namespace cloudy {
@@ -55,8 +56,9 @@ namespace cloudy {
       
       //////////////////////////////////////////////////////////////////////
 
-      // The coordinates of v are M11 M12 M13 M21 M23 M33
-      typedef cloudy::uvector Covariance_vector;
+      // The coordinates of v are M11 M12 M13 M22 M23 M33; it is
+      // stored in place, so that integrating does not allocate.
+      typedef cloudy::linear::Sym3 Covariance_vector;
       
       template <class K>
       class Covariance_integrator
@@ -73,11 +75,9 @@ namespace cloudy {
 	    
 	 public:
 	    Covariance_integrator(const Point &center):
-	       _result(6),
+	       _result(),
 	       _center(center)
-	    {
-	       std::fill(_result.begin(), _result.end(), 0);
-	    }
+	    {}
 	    
 	    void aggregate(const Vector &a, 
 	                   const Vector &b,
@@ -107,14 +107,14 @@ namespace cloudy {
 		         m33*m21/2.0 + m33*m22/2.0 + m33*m23) * det60,
 		  R33 = (m31*m31 + m31*m32 + m31*m33 +
 		         m32*m32 + m32*m33 + m33*m33) * det60;
-	       _result(0) += R11;
-	       _result(1) += R12;
-	       _result(2) += R13;
+	       _result[0] += R11;
+	       _result[1] += R12;
+	       _result[2] += R13;
 
-	       _result(3) += R22;
-	       _result(4) += R23;
+	       _result[3] += R22;
+	       _result[4] += R23;
 
-	       _result(5) += R33;
+	       _result[5] += R33;
 	    }
 	    
 	    const Result_type &result() const
@@ -1,6 +1,10 @@
 #ifndef CLOUDY_RANDOM_RANDOM_HPP
+#define CLOUDY_RANDOM_RANDOM_HPP
 
 #include <cloudy/linear/Linear.hpp>
+#include <boost/cstdint.hpp>
+#include <algorithm>
+#include <math.h>
 #include <boost/random/normal_distribution.hpp>
 #include <boost/random/uniform_real.hpp>
 #include <boost/random/uniform_int.hpp>
@@ -84,6 +88,191 @@ namespace cloudy
 	    double r = _radius*pow(_u01(eng), 1.0/dir.size());
 	    return (r/ublas::norm_2(dir))*dir;
 	 }
+
+	 template <class Engine>
+	 void restart (Engine &)
+	 {}
+   };
+
+   // Volume-preserving map from the unit cube to the 3D ball, so that
+   // low-discrepancy point sets of the cube stay well spread in the
+   // ball: u drives the radius, v and w the direction.
+   template <class Vector>
+   Vector cube_to_ball (double u, double v, double w, double radius)
+   {
+      double r = radius * cbrt(u);
+      double z = 1.0 - 2.0 * v;
+      double s = r * sqrt(std::max(1.0 - z*z, 0.0));
+      double phi = 2.0 * M_PI * w;
+
+      Vector res(3);
+      res[0] = s * cos(phi);
+      res[1] = s * sin(phi);
+      res[2] = r * z;
+      return res;
+   }
+
+   // Scrambled Sobol points in the 3D ball. The generator matrices are
+   // scrambled by a random lower triangular matrix (Matousek's linear
+   // scrambling) and shifted by a random digital shift at each
+   // restart(), so that successive runs are independent randomized
+   // quasi-Monte Carlo estimates.
+   template <class Vector>
+   class Sobol_vector_in_ball
+   {
+	 typedef boost::uint32_t Word;
+
+	 double _radius;
+	 Word _directions[3][32];
+	 Word _scrambled[3][32];
+	 Word _shift[3];
+	 Word _x[3];
+	 Word _index;
+	 boost::uniform_int<Word> _uword;
+
+	 static Word parity(Word w)
+	 {
+	    w ^= w >> 16; w ^= w >> 8; w ^= w >> 4;
+	    w ^= w >> 2; w ^= w >> 1;
+	    return w & 1;
+	 }
+
+	 static size_t lowest_zero_bit(Word w)
+	 {
+	    size_t c = 0;
+	    while (w & 1)
+	    {
+	       w >>= 1;
+	       ++c;
+	    }
+	    return c;
+	 }
+
+      public:
+	 Sobol_vector_in_ball (size_t dim, double radius) :
+	    _radius (radius),
+	    _uword (0, ~Word(0))
+	 {
+	    assert(dim == 3);
+
+	    // Joe & Kuo direction numbers for the first three dimensions
+	    for (size_t k = 0; k < 32; ++k)
+	       _directions[0][k] = Word(1) << (31 - k);
+
+	    _directions[1][0] = Word(1) << 31;
+	    for (size_t k = 1; k < 32; ++k)
+	       _directions[1][k] = 
+		  _directions[1][k-1] ^ (_directions[1][k-1] >> 1);
+
+	    _directions[2][0] = Word(1) << 31;
+	    _directions[2][1] = Word(3) << 30;
+	    for (size_t k = 2; k < 32; ++k)
+	       _directions[2][k] = _directions[2][k-2]
+		  ^ (_directions[2][k-2] >> 2) ^ _directions[2][k-1];
+
+	    for (size_t d = 0; d < 3; ++d)
+	    {
+	       std::copy(_directions[d], _directions[d] + 32, _scrambled[d]);
+	       _shift[d] = 0;
+	       _x[d] = 0;
+	    }
+	    _index = 0;
+	 }
+
+	 template <class Engine>
+	 void restart (Engine &eng)
+	 {
+	    for (size_t d = 0; d < 3; ++d)
+	    {
+	       Word rows[32];
+	       for (size_t i = 0; i < 32; ++i)
+	       {
+		  Word high = (i == 0) ? 0 : (~Word(0) << (32 - i));
+		  rows[i] = (Word(1) << (31 - i)) | (_uword(eng) & high);
+	       }
+
+	       for (size_t k = 0; k < 32; ++k)
+	       {
+		  Word v = 0;
+		  for (size_t i = 0; i < 32; ++i)
+		     v |= parity(rows[i] & _directions[d][k]) << (31 - i);
+		  _scrambled[d][k] = v;
+	       }
+	       _shift[d] = _uword(eng);
+	       _x[d] = 0;
+	    }
+	    _index = 0;
+	 }
+
+	 template <class Engine>
+	 Vector operator () (Engine &eng)
+	 {
+	    const double scale = 1.0/4294967296.0;
+	    double u[3];
+	    for (size_t d = 0; d < 3; ++d)
+	       u[d] = ((_x[d] ^ _shift[d]) + 0.5) * scale;
+
+	    // Gray code ordering: the next point differs from the
+	    // current one by a single direction number
+	    size_t c = lowest_zero_bit(_index++);
+	    for (size_t d = 0; d < 3; ++d)
+	       _x[d] ^= _scrambled[d][c];
+
+	    return cube_to_ball<Vector>(u[0], u[1], u[2], _radius);
+	 }
+   };
+
+   // Jittered sampling of the 3D ball: the unit cube is cut into m^3
+   // cells, m being the largest integer such that m^3 <= samples, and
+   // every cell receives one uniform point per pass, cells being
+   // visited in a random order drawn at each restart().
+   template <class Vector>
+   class Stratified_vector_in_ball
+   {
+	 double _radius;
+	 size_t _m;
+	 std::vector<size_t> _cells;
+	 size_t _index;
+	 boost::uniform_real<> _u01;
+
+      public:
+	 Stratified_vector_in_ball (size_t dim, double radius,
+				    size_t samples) :
+	    _radius (radius),
+	    _m (1),
+	    _index (0)
+	 {
+	    assert(dim == 3);
+
+	    while ((_m+1)*(_m+1)*(_m+1) <= samples)
+	       ++_m;
+	    _cells.resize(_m * _m * _m);
+	    for (size_t i = 0; i < _cells.size(); ++i)
+	       _cells[i] = i;
+	 }
+
+	 template <class Engine>
+	 void restart (Engine &eng)
+	 {
+	    for (size_t i = _cells.size() - 1; i > 0; --i)
+	    {
+	       boost::uniform_int<size_t> ui(0, i);
+	       std::swap(_cells[i], _cells[ui(eng)]);
+	    }
+	    _index = 0;
+	 }
+
+	 template <class Engine>
+	 Vector operator () (Engine &eng)
+	 {
+	    size_t c = _cells[_index];
+	    _index = (_index + 1) % _cells.size();
+
+	    double u = ((c % _m) + _u01(eng))/_m;
+	    double v = (((c / _m) % _m) + _u01(eng))/_m;
+	    double w = ((c / (_m * _m)) + _u01(eng))/_m;
+	    return cube_to_ball<Vector>(u, v, w, _radius);
+	 }
    };
 
    template <class Point>
@@ -115,6 +304,133 @@ namespace cloudy
 	    return ta * _a + tb * _b + tc * _c;
 	 }
    };
+
+   // Uniform points in a union of cubic voxels covering a family of
+   // balls of radius R. A voxel is kept when it lies within distance R
+   // of a voxel containing a center, so the cover is a (slightly
+   // larger) superset of the union of balls; callers reject the
+   // samples that fall outside of it.
+   template <class Vector>
+   class Random_point_in_voxel_cover
+   {
+	 typedef boost::uint64_t Key;
+
+	 static const size_t _bits = 21;
+
+	 std::vector<Key> _voxels;
+	 double _origin[3];
+	 double _cell;
+	 boost::uniform_real<> _u01;
+
+	 Key key(long x, long y, long z) const
+	 {
+	    return ((Key(x) << (2*_bits)) | (Key(y) << _bits) | Key(z));
+	 }
+
+      public:
+	 template <class Cloud>
+	 Random_point_in_voxel_cover (const Cloud &centers,
+				      double radius,
+				      double cell = 0.0) :
+	    _cell (cell > 0.0 ? cell : radius/2.0)
+	 {
+	    if (centers.size() == 0)
+	       return;
+
+	    assert(_cell > 0.0);
+
+	    double lo[3], extent = 0.0;
+	    for (size_t d = 0; d < 3; ++d)
+	    {
+	       double hi = lo[d] = centers[0][d];
+	       for (size_t i = 1; i < centers.size(); ++i)
+	       {
+		  lo[d] = std::min(lo[d], double(centers[i][d]));
+		  hi = std::max(hi, double(centers[i][d]));
+	       }
+	       extent = std::max(extent, hi - lo[d]);
+	    }
+
+	    // every cell coordinate must fit in _bits bits, or distinct
+	    // voxels would share a key: coarsen the grid until the
+	    // dilated bounding box does. A coarser cover is still a
+	    // cover, only a looser one.
+	    long reach = long(ceil(radius/_cell));
+	    while (extent/_cell + 2 * (reach + 2) >= double(Key(1) << _bits))
+	    {
+	       _cell *= 2.0;
+	       reach = long(ceil(radius/_cell));
+	    }
+
+	    // shift the grid so that every voxel of the cover has
+	    // non-negative coordinates
+	    for (size_t d = 0; d < 3; ++d)
+	       _origin[d] = lo[d] - (reach + 1) * _cell;
+
+	    std::vector<Key> occupied;
+	    occupied.reserve(centers.size());
+	    for (size_t i = 0; i < centers.size(); ++i)
+	       occupied.push_back
+		  (key(long((centers[i][0] - _origin[0])/_cell),
+		       long((centers[i][1] - _origin[1])/_cell),
+		       long((centers[i][2] - _origin[2])/_cell)));
+	    std::sort(occupied.begin(), occupied.end());
+	    occupied.erase(std::unique(occupied.begin(), occupied.end()),
+			   occupied.end());
+
+	    // dilate the occupied voxels by every voxel whose
+	    // box-to-box distance is at most R
+	    const Key mask = (Key(1) << _bits) - 1;
+	    const double r2 = radius * radius;
+	    for (size_t i = 0; i < occupied.size(); ++i)
+	    {
+	       long x = long((occupied[i] >> (2*_bits)) & mask);
+	       long y = long((occupied[i] >> _bits) & mask);
+	       long z = long(occupied[i] & mask);
+
+	       for (long dx = -reach; dx <= reach; ++dx)
+		  for (long dy = -reach; dy <= reach; ++dy)
+		     for (long dz = -reach; dz <= reach; ++dz)
+		     {
+			double gx = std::max(labs(dx) - 1, 0L) * _cell;
+			double gy = std::max(labs(dy) - 1, 0L) * _cell;
+			double gz = std::max(labs(dz) - 1, 0L) * _cell;
+			if (gx*gx + gy*gy + gz*gz <= r2)
+			   _voxels.push_back(key(x + dx, y + dy, z + dz));
+		     }
+	    }
+	    std::sort(_voxels.begin(), _voxels.end());
+	    _voxels.erase(std::unique(_voxels.begin(), _voxels.end()),
+			  _voxels.end());
+	 }
+
+	 size_t num_voxels() const
+	 {
+	    return _voxels.size();
+	 }
+
+	 double volume() const
+	 {
+	    return _voxels.size() * _cell * _cell * _cell;
+	 }
+
+	 template <class Engine>
+	 Vector operator () (Engine &eng) const
+	 {
+	    assert(_voxels.size() != 0);
+
+	    const Key mask = (Key(1) << _bits) - 1;
+	    size_t i = std::min(size_t(_u01(eng) * _voxels.size()),
+				_voxels.size() - 1);
+	    Key k = _voxels[i];
+
+	    Vector res(3);
+	    res[0] = _origin[0] + (((k >> (2*_bits)) & mask) + _u01(eng))*_cell;
+	    res[1] = _origin[1] + (((k >> _bits) & mask) + _u01(eng))*_cell;
+	    res[2] = _origin[2] + ((k & mask) + _u01(eng))*_cell;
+	    return res;
+	 }
+   };
   }
 }
 
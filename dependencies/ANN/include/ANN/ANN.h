@@ -709,6 +709,8 @@ protected:
 	ANNpoint		bnd_box_lo;			// bounding box low point
 	ANNpoint		bnd_box_hi;			// bounding box high point
 
+	friend class ANNkd_inc_search;		// incremental search
+
 	void SkeletonTree(					// construct skeleton tree
 		int				n,				// number of points
 		int				dd,				// dimension
@@ -777,6 +779,47 @@ public:
 		ANNkdStats&		st);			// the statistics (modified)
 };								
 
+//----------------------------------------------------------------------
+//	Incremental nearest neighbor search
+//		ANNkd_inc_search reports the points of a kd-tree (or bd-tree)
+//		one at a time, in increasing order of distance to a query
+//		point.  The traversal state is kept between calls to next(),
+//		so that the caller may decide on the fly how many neighbors
+//		it needs, without ever restarting the search.
+//
+//		start() begins a new search, reusing the storage of the
+//		previous one.  The query point is not copied and must remain
+//		valid until the search is over.  If eps > 0, a point may be
+//		reported before a closer one, by a factor at most (1+eps) on
+//		distances.  Points whose squared distance exceeds sqBound
+//		are never reported.  next() returns ANNfalse when no point is
+//		left.
+//----------------------------------------------------------------------
+
+class ANNkd_inc_queue;					// state of the search
+
+class DLL_API ANNkd_inc_search {
+	ANNkd_tree*			tree;			// the tree being searched
+	ANNkd_inc_queue*	queue;			// nodes and points to visit
+
+	ANNkd_inc_search(const ANNkd_inc_search&);			// not copyable
+	ANNkd_inc_search& operator=(const ANNkd_inc_search&);
+public:
+	ANNkd_inc_search(					// attach to a tree
+		ANNkd_tree*		t);				// the tree
+
+	~ANNkd_inc_search();
+
+	void start(							// begin a new search
+		ANNpoint		q,				// query point
+		double			eps=0.0,		// error bound
+		ANNdist			sqBound=ANN_DIST_INF);	// squared distance bound
+
+	ANNbool next(						// report the next neighbor
+		ANNidx			&idx,			// its index (returned)
+		ANNdist			&dd);			// its squared distance (returned)
+};
+
 //----------------------------------------------------------------------
 //	Box decomposition tree (bd-tree)
 //		The bd-tree is inherited from a kd-tree.  The main difference
@@ -55,6 +55,7 @@ enum ANNerr {ANNwarn = 0, ANNabort = 1};
 
 extern int		ANNmaxPtsVisited;	// maximum number of pts visited
 extern int		ANNptsVisited;		// number of pts visited in search
+#pragma omp threadprivate(ANNptsVisited)
 
 //----------------------------------------------------------------------
 //	Global function declarations
@@ -0,0 +1,31 @@
+//----------------------------------------------------------------------
+// File:			bd_inc_search.cpp
+// Description:		Incremental nearest neighbor search for bd-trees
+//----------------------------------------------------------------------
+// This file is an extension of the Approximate Nearest Neighbor
+// Library (ANN), and is provided under the same terms (Lesser GNU
+// Public License).  See the file ../ReadMe.txt for further information.
+//----------------------------------------------------------------------
+
+#include "bd_tree.h"					// bd-tree declarations
+#include "kd_inc_search.h"				// kd incremental search decls
+
+//----------------------------------------------------------------------
+//	bd_shrink::ann_inc_expand - push the children of a shrinking node
+//		The inner box is contained in the node's box, so the larger
+//		of the two distances is a lower bound for the inner child.
+//----------------------------------------------------------------------
+
+void ANNbd_shrink::ann_inc_expand(ANNkd_inc_queue &queue, ANNdist box_dist)
+{
+	ANNdist inner_dist = 0;						// distance to inner box
+	for (int i = 0; i < n_bnds; i++) {
+		if (bnds[i].out(queue.q))
+			inner_dist = (ANNdist) ANN_SUM(inner_dist, bnds[i].dist(queue.q));
+	}
+	if (inner_dist < box_dist)
+		inner_dist = box_dist;
+
+	queue.pushNode(child[ANN_IN], inner_dist);
+	queue.pushNode(child[ANN_OUT], box_dist);
+}
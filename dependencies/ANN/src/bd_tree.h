@@ -95,6 +95,7 @@ public:
 	virtual void ann_search(ANNdist);			// standard search
 	virtual void ann_pri_search(ANNdist);		// priority search
 	virtual void ann_FR_search(ANNdist); 		// fixed-radius search
+	virtual void ann_inc_expand(ANNkd_inc_queue&, ANNdist); // incremental
 };
 
 #endif
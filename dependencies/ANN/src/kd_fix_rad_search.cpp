@@ -51,6 +51,10 @@ ANNmin_k*		ANNkdFRPointMK;			// set of k closest points
 int				ANNkdFRPtsVisited;		// total points visited
 int				ANNkdFRPtsInRange;		// number of points in the range
 
+#pragma omp threadprivate(ANNkdFRDim, ANNkdFRSqRad, ANNkdFRMaxErr, \
+			 ANNkdFRPts, ANNkdFRPointMK, ANNkdFRPtsVisited, \
+			 ANNkdFRPtsInRange)
+
 //----------------------------------------------------------------------
 //	annkFRSearch - fixed radius search for k nearest neighbors
 //----------------------------------------------------------------------
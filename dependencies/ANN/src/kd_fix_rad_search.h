@@ -41,4 +41,7 @@
 
 extern ANNpoint			ANNkdFRQ;			// query point (static copy)
 
+// one copy per thread, so that concurrent searches do not interfere
+#pragma omp threadprivate(ANNkdFRQ)
+
 #endif
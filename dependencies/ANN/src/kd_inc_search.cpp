@@ -0,0 +1,159 @@
+//----------------------------------------------------------------------
+// File:			kd_inc_search.cpp
+// Description:		Incremental nearest neighbor search for kd-trees
+//----------------------------------------------------------------------
+// This file is an extension of the Approximate Nearest Neighbor
+// Library (ANN), and is provided under the same terms (Lesser GNU
+// Public License).  See the file ../ReadMe.txt for further information.
+//----------------------------------------------------------------------
+
+#include "kd_inc_search.h"				// kd incremental search decls
+
+#include <algorithm>
+
+//----------------------------------------------------------------------
+//	Incremental nearest neighbor search.
+//		Best-first traversal of the tree (Hjaltason and Samet): the
+//		smallest item of the queue is repeatedly removed; a node is
+//		expanded by pushing its children (or its points, for a leaf),
+//		and a point is reported.  Since a node is pushed with a lower
+//		bound on the distance of all its points, points come out in
+//		increasing order of distance.  With eps > 0, the keys of the
+//		nodes are multiplied by (1+eps)^2, so that points may be
+//		reported before a closer point by a factor at most (1+eps).
+//----------------------------------------------------------------------
+
+static bool ANNincGreater(
+	const ANNkd_inc_queue::Item &a,
+	const ANNkd_inc_queue::Item &b)
+{
+	if (a.key != b.key)
+		return a.key > b.key;
+	return a.node != NULL && b.node == NULL; // report points first
+}
+
+void ANNkd_inc_queue::pushNode(ANNkd_ptr node, ANNdist box_dist)
+{
+	if (box_dist > sqBound)
+		return;
+	Item it;
+	it.key = (ANNdist) (box_dist * maxErr);
+	it.dist = box_dist;
+	it.node = node;
+	it.idx = ANN_NULL_IDX;
+	heap.push_back(it);
+	std::push_heap(heap.begin(), heap.end(), ANNincGreater);
+}
+
+void ANNkd_inc_queue::pushPoint(ANNidx idx, ANNdist dist)
+{
+	if (dist > sqBound)
+		return;
+	Item it;
+	it.key = dist;
+	it.dist = dist;
+	it.node = NULL;
+	it.idx = idx;
+	heap.push_back(it);
+	std::push_heap(heap.begin(), heap.end(), ANNincGreater);
+}
+
+ANNkd_inc_queue::Item ANNkd_inc_queue::pop()
+{
+	std::pop_heap(heap.begin(), heap.end(), ANNincGreater);
+	Item it = heap.back();
+	heap.pop_back();
+	return it;
+}
+
+ANNkd_inc_search::ANNkd_inc_search(ANNkd_tree* t)
+{
+	tree = t;
+	queue = new ANNkd_inc_queue;
+	queue->dim = t->dim;
+	queue->pts = t->pts;
+	queue->q = NULL;
+	queue->maxErr = 1.0;
+	queue->sqBound = ANN_DIST_INF;
+}
+
+ANNkd_inc_search::~ANNkd_inc_search()
+{
+	delete queue;
+}
+
+void ANNkd_inc_search::start(
+	ANNpoint			q,				// the query point
+	double				eps,			// the error bound
+	ANNdist				sqBound)		// squared distance bound
+{
+	queue->q = q;
+	queue->maxErr = ANN_POW(1.0 + eps);
+	queue->sqBound = sqBound;
+	queue->heap.clear();				// keep the allocated storage
+
+	queue->pushNode(tree->root,
+		annBoxDistance(q, tree->bnd_box_lo, tree->bnd_box_hi, tree->dim));
+}
+
+ANNbool ANNkd_inc_search::next(
+	ANNidx				&idx,			// index of the next point
+	ANNdist				&dd)			// its squared distance
+{
+	while (!queue->heap.empty()) {
+		ANNkd_inc_queue::Item it = queue->pop();
+		if (it.node == NULL) {
+			idx = it.idx;
+			dd = it.dist;
+			return ANNtrue;
+		}
+		it.node->ann_inc_expand(*queue, it.dist);
+	}
+	return ANNfalse;
+}
+
+//----------------------------------------------------------------------
+//	kd_split::ann_inc_expand - push the children of a splitting node
+//		The closer child has the same box distance as the node, the
+//		distance to the further one is updated incrementally as in
+//		the standard search.
+//----------------------------------------------------------------------
+
+void ANNkd_split::ann_inc_expand(ANNkd_inc_queue &queue, ANNdist box_dist)
+{
+	ANNcoord cut_diff = queue.q[cut_dim] - cut_val;
+	int close = (cut_diff < 0) ? ANN_LO : ANN_HI;
+
+	ANNcoord box_diff = (cut_diff < 0)
+		? cd_bnds[ANN_LO] - queue.q[cut_dim]
+		: queue.q[cut_dim] - cd_bnds[ANN_HI];
+	if (box_diff < 0)					// within bounds - ignore
+		box_diff = 0;
+
+	ANNdist far_dist = (ANNdist) ANN_SUM(box_dist,
+			ANN_DIFF(ANN_POW(box_diff), ANN_POW(cut_diff)));
+
+	queue.pushNode(child[close], box_dist);
+	queue.pushNode(child[1 - close], far_dist);
+}
+
+//----------------------------------------------------------------------
+//	kd_leaf::ann_inc_expand - push the points of a leaf
+//----------------------------------------------------------------------
+
+void ANNkd_leaf::ann_inc_expand(ANNkd_inc_queue &queue, ANNdist box_dist)
+{
+	for (int i = 0; i < n_pts; i++) {
+		ANNcoord* pp = queue.pts[bkt[i]];
+		ANNcoord* qq = queue.q;
+		ANNdist dist = 0;
+
+		for (int d = 0; d < queue.dim; d++) {
+			ANNcoord t = *(qq++) - *(pp++);
+			dist = ANN_SUM(dist, ANN_POW(t));
+		}
+
+		if (ANN_ALLOW_SELF_MATCH || dist != 0)
+			queue.pushPoint(bkt[i], dist);
+	}
+}
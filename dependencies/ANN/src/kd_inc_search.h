@@ -0,0 +1,50 @@
+//----------------------------------------------------------------------
+// File:			kd_inc_search.h
+// Description:		Incremental nearest neighbor search for kd-trees
+//----------------------------------------------------------------------
+// This file is an extension of the Approximate Nearest Neighbor
+// Library (ANN), and is provided under the same terms (Lesser GNU
+// Public License).  See the file ../ReadMe.txt for further information.
+//----------------------------------------------------------------------
+
+#ifndef ANN_kd_inc_search_H
+#define ANN_kd_inc_search_H
+
+#include "kd_tree.h"					// kd-tree declarations
+#include "kd_util.h"					// kd-tree utilities
+
+#include <vector>
+
+//----------------------------------------------------------------------
+//	ANNkd_inc_queue
+//		State of an incremental search: the query and a min-heap of
+//		the nodes still to be expanded (keyed by their box distance,
+//		scaled by the error factor) and of the points still to be
+//		reported (keyed by their distance).  Unlike the other kd-tree
+//		searches, nothing is kept in global variables, so that
+//		several incremental searches can be interleaved or run
+//		concurrently.
+//----------------------------------------------------------------------
+
+class ANNkd_inc_queue {
+public:
+	struct Item {
+		ANNdist			key;			// priority in the heap
+		ANNdist			dist;			// (box) distance to the query
+		ANNkd_ptr		node;			// node to expand (NULL for a point)
+		ANNidx			idx;			// point index
+	};
+
+	int					dim;			// dimension of space
+	ANNpoint			q;				// query point
+	ANNpointArray		pts;			// the points
+	double				maxErr;			// (1+eps)^2
+	ANNdist				sqBound;		// squared distance bound
+	std::vector<Item>	heap;			// nodes and points to visit
+
+	void pushNode(ANNkd_ptr node, ANNdist box_dist);
+	void pushPoint(ANNidx idx, ANNdist dist);
+	Item pop();
+};
+
+#endif
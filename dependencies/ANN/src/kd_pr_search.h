@@ -46,4 +46,8 @@ extern ANNpointArray	ANNprPts;		// the points
 extern ANNpr_queue		*ANNprBoxPQ;	// priority queue for boxes
 extern ANNmin_k			*ANNprPointMK;	// set of k closest points
 
+// one copy per thread, so that concurrent searches do not interfere
+#pragma omp threadprivate(ANNprEps, ANNprDim, ANNprQ, ANNprMaxErr, ANNprPts, \
+			 ANNprBoxPQ, ANNprPointMK)
+
 #endif
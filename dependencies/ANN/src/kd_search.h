@@ -45,4 +45,7 @@ extern ANNpointArray	ANNkdPts;		// the points (static copy)
 // extern ANNmin_k			*ANNkdPointMK;	// set of k closest points
 extern int				ANNptsVisited;	// number of points visited
 
+// one copy per thread, so that concurrent searches do not interfere
+#pragma omp threadprivate(ANNkdDim, ANNkdMaxErr, ANNkdPts)
+
 #endif
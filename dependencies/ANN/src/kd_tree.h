@@ -30,6 +30,8 @@
 #include <ANN/ANNx.h>					// all ANN includes
 #include "pr_queue_k.h"					// k-element priority queue
 
+class ANNkd_inc_queue;					// incremental search state
+
 using namespace std;					// make std:: available
 
 //----------------------------------------------------------------------
@@ -52,6 +54,9 @@ public:
 	virtual void ann_search(ANNpoint& ANNkdQ, ANNmin_k* ANNkdPointMK,  ANNdist) {}		// tree search
 	virtual void ann_pri_search(ANNdist) = 0;	// priority search
 	virtual void ann_FR_search(ANNdist) = 0;	// fixed-radius search
+	virtual void ann_inc_expand(				// incremental search
+				ANNkd_inc_queue &queue,			// search state
+				ANNdist box_dist) = 0;			// distance to the node
 
 	virtual void getStats(						// get tree statistics
 				int dim,						// dimension of space
@@ -115,6 +120,7 @@ public:
 	virtual void ann_search(ANNpoint& ANNkdQ, ANNmin_k* ANNkdPointMK, ANNdist);			// standard search
 	virtual void ann_pri_search(ANNdist);		// priority search
 	virtual void ann_FR_search(ANNdist);		// fixed-radius search
+	virtual void ann_inc_expand(ANNkd_inc_queue&, ANNdist); // incremental
 };
 
 //----------------------------------------------------------------------
@@ -181,6 +187,7 @@ public:
 	virtual void ann_search(ANNpoint& ANNkdQ, ANNmin_k* ANNkdPointMK, ANNdist);			// standard search
 	virtual void ann_pri_search(ANNdist);		// priority search
 	virtual void ann_FR_search(ANNdist);		// fixed-radius search
+	virtual void ann_inc_expand(ANNkd_inc_queue&, ANNdist); // incremental
 };
 
 //----------------------------------------------------------------------
@@ -1,5 +1,4 @@
 #include <cloudy/linear/Covariance.hpp>
-#include <cloudy/misc/Progress.hpp>
 
 #include "torus.hpp"
 #include "pctviewer.hpp"
@@ -13,22 +12,8 @@ void diagonalize(const Data_cloud_ptr &covariance,
 		 Data_cloud_ptr &K2,
 		 Scalar_field_ptr &anisotropy)
 {
-  cloudy::misc::Progress_display progress(covariance->size(), std::cerr);
-   for (Data_cloud::iterator it = covariance->begin();
-        it != covariance->end(); ++it)
-   {
-      std::vector<double> V;
-      std::vector<uvector> D;
-
-      linear::covariance_extract_eigen
-	(linear::matrix_from_covariance_3(*it), V, D);
-      linear::covariance_sort_eigen(V, D);
-      normals->push_back(D[0]);
-      K1->push_back(D[1]);
-      K2->push_back(D[2]);
-      anisotropy->push_back(V[1]/(V[0] + V[1] + V[2]));
-      ++progress;
-   }
+  linear::covariance_diagonalize_3(*covariance, *normals, *K1, *K2,
+				   *anisotropy);
    std::cerr << "done\n";
 }
 
@@ -17,9 +17,11 @@ void Process_all(std::istream &isCloud,
                  std::istream &isOff, 
                  std::ostream &os,
 		 double r,
+		 double eps,
 		 size_t comp = 0,
 		 size_t clamp = 3,
-		 double tmax = -1.0)
+		 double tmax = -1.0,
+		 bool rgb8 = false)
 {
   std::cerr << "loading cloud\n";
     cloudy::Data_cloud points;
@@ -56,14 +58,23 @@ void Process_all(std::istream &isCloud,
        return;
 
     cloudy::KD_tree kd(points);
-    cloudy::Convolution_tent_functor<double> f(kd, field, r);
+    cloudy::Convolution_tent_functor<double> f(kd, field, r, eps);
     //cloudy::Convolution_uniform_functor<double> f(kd, field, r);
 
     if (tmax > 0.0)
       mesh.simple_tesselate(tmax);
 
-    mesh.simple_colorize(f, ggr);
-    mesh.write_off(os);
+    if (rgb8)
+    {
+       std::vector<unsigned char> rgb;
+       mesh.simple_colorize_rgb8(f, ggr, rgb);
+       mesh.write_off(os, rgb);
+    }
+    else
+    {
+       mesh.simple_colorize(f, ggr);
+       mesh.write_off(os);
+    }
 }
 
 int main(int argc, char **argv)
@@ -73,14 +84,16 @@ int main(int argc, char **argv)
    cloudy::misc::get_options (argc, argv, options, param);
 
    double r = cloudy::misc::to_double(options["r"], 0.05);
+   double eps = cloudy::misc::to_double(options["eps"], 0.0);
    double tmax = cloudy::misc::to_double(options["tmax"], -1);
    size_t comp = cloudy::misc::to_int(options["comp"], 0);
    size_t clamp = cloudy::misc::to_int(options["clamp"], 3);
+   bool rgb8 = (options["rgb8"] == "true");
    
 
    if (param.size() < 2)
    {
-      std::cerr << "Usage: " << argv[0] << " file.cloud file.p file.ggr file.off [outfile.off -r radius -comp component -clamp dimension -tmax triangle max size]"
+      std::cerr << "Usage: " << argv[0] << " file.cloud file.p file.ggr file.off [outfile.off -r radius -eps approximation -comp component -clamp dimension -tmax triangle max size +rgb8]"
 		<< std::endl;
       return -1;
    }
@@ -94,8 +107,8 @@ int main(int argc, char **argv)
    {
      std::cerr << "outputing in " << param[4] << "\n";
       std::ofstream os(param[4].c_str());
-      Process_all(isCloud, isField, isGradient, isOff, os, r, comp, clamp, tmax);
+      Process_all(isCloud, isField, isGradient, isOff, os, r, eps, comp, clamp, tmax, rgb8);
    }
    else
-     Process_all(isCloud, isField, isGradient, isOff, std::cout, r, comp, clamp, tmax);
+     Process_all(isCloud, isField, isGradient, isOff, std::cout, r, eps, comp, clamp, tmax, rgb8);
 }
@@ -0,0 +1,234 @@
+#include <cloudy/misc/Program_options.hpp>
+#include <cloudy/Cloud.hpp>
+#include <cloudy/KD_tree.hpp>
+#include <cloudy/Distance_to_measure.hpp>
+#include <cloudy/Grid_index.hpp>
+#include <math.h>
+
+#include <boost/timer.hpp>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+using namespace cloudy;
+
+// Relative error statistics of approximate values against exact ones.
+struct Error_stats
+{
+  double max, mean;
+};
+
+Error_stats
+Compare(const std::vector<double> &exact, const std::vector<double> &approx)
+{
+  Error_stats e = {0.0, 0.0};
+  for (size_t i = 0; i < exact.size(); ++i)
+    {
+      double err = fabs(approx[i] - exact[i]);
+      if (exact[i] != 0.0)
+	err /= fabs(exact[i]);
+      e.max = std::max(e.max, err);
+      e.mean += err;
+    }
+  if (exact.size() > 0)
+    e.mean /= double(exact.size());
+  return e;
+}
+
+void
+Report(std::ostream &os, const std::string &kernel, double eps,
+       size_t n, double elapsed, const Error_stats &e)
+{
+  os << kernel << "\t" << eps << "\t"
+     << double(n)/std::max(elapsed, 1e-9) << "\t"
+     << e.max << "\t" << e.mean << "\n";
+}
+
+// Distance to the uniform measure of mass m at the first n points.
+double
+Time_distance(const KD_tree &kd, const Data_cloud &points, size_t n,
+	      double m, double eps, std::vector<double> &res)
+{
+  std::vector<double> masses(1, m), W(kd.size(), 1.0/double(kd.size()));
+  KD_tree::Nearest_neighbor_iterator nn(kd);
+  uvector bary(kd.dim());
+  double h, squared_radius;
+
+  res.resize(n);
+  boost::timer t;
+  for (size_t i = 0; i < n; ++i)
+    {
+      k_distance(masses, 0.0, kd, W, points[i], &h, bary, nn,
+		 ANN_DIST_INF, squared_radius, eps);
+      res[i] = sqrt(h);
+    }
+  return t.elapsed();
+}
+
+// Number of points in the ball of radius r around the first n points.
+double
+Time_ball(const KD_tree &kd, const Data_cloud &points, size_t n,
+	  double r, double eps, std::vector<double> &res)
+{
+  res.resize(n);
+  boost::timer t;
+  for (size_t i = 0; i < n; ++i)
+    res[i] = double(kd.count_points_in_ball(points[i], r, eps));
+  return t.elapsed();
+}
+
+// For each value of eps, run the kNN (distance to measure) and ball
+// queries at the first n points of the cloud, and report the number
+// of queries per second and the relative error against eps = 0. The
+// queries run on a single thread, so that the throughput is per core.
+void
+Benchmark_eps(const Data_cloud &points, const KD_tree &kd, size_t n,
+	      size_t k, double r, const std::vector<double> &epsilons,
+	      std::ostream &os)
+{
+  std::vector<double> d0, b0, d, b;
+  Error_stats exact = {0.0, 0.0};
+
+  os << "# kernel\teps\tqueries/s\tmax error\tmean error\n";
+
+  double td = Time_distance(kd, points, n, 1.0/double(k), 0.0, d0);
+  Report(os, "distance", 0.0, n, td, exact);
+  for (size_t j = 0; j < epsilons.size(); ++j)
+    {
+      td = Time_distance(kd, points, n, 1.0/double(k), epsilons[j], d);
+      Report(os, "distance", epsilons[j], n, td, Compare(d0, d));
+    }
+
+  double tb = Time_ball(kd, points, n, r, 0.0, b0);
+  Report(os, "ball", 0.0, n, tb, exact);
+  for (size_t j = 0; j < epsilons.size(); ++j)
+    {
+      tb = Time_ball(kd, points, n, r, epsilons[j], b);
+      Report(os, "ball", epsilons[j], n, tb, Compare(b0, b));
+    }
+}
+
+template <class Index>
+double
+Time_count(const Index &index, const Data_cloud &points, size_t n,
+	   double r, std::vector<double> &res)
+{
+  res.resize(n);
+  boost::timer t;
+  for (size_t i = 0; i < n; ++i)
+    res[i] = double(index.count_points_in_ball(points[i], r));
+  return t.elapsed();
+}
+
+template <class Index>
+double
+Time_nn(const Index &index, const Data_cloud &points, size_t n,
+	double shift, std::vector<double> &res)
+{
+  res.resize(n);
+  boost::timer t;
+  for (size_t i = 0; i < n; ++i)
+    {
+      uvector p = points[i];
+      p[0] += shift;
+      res[i] = double(index.find_nn(p));
+    }
+  return t.elapsed();
+}
+
+// Compare the kd-tree (ANN) with the uniform grid of cell size r on
+// the ball count and nearest neighbour queries at the first n points,
+// the nearest neighbour queries being slightly shifted so that they
+// do not fall on the points. The build times are reported in the
+// throughput column, in seconds, the kd-tree being the one built by
+// main in tk seconds; the error columns count the queries where the
+// two indices disagree (for nearest neighbours, only a tie can make
+// them disagree).
+void
+Benchmark_index(const Data_cloud &points, const KD_tree &kd, double tk,
+		size_t n, double r, std::ostream &os)
+{
+  os << "# index\top\tqueries/s\tmismatches\n";
+
+  boost::timer t;
+  Grid_index grid(points, r);
+  double tg = t.elapsed();
+  os << "kd\tbuild\t" << tk << "s\t0\n";
+  os << "grid\tbuild\t" << tg << "s\t0\n";
+
+  std::vector<double> a, b;
+  double ta = Time_count(kd, points, n, r, a);
+  double tb = Time_count(grid, points, n, r, b);
+  size_t mismatches = 0;
+  for (size_t i = 0; i < n; ++i)
+    mismatches += (a[i] != b[i]);
+  os << "kd\tball\t" << double(n)/std::max(ta, 1e-9) << "\t0\n";
+  os << "grid\tball\t" << double(n)/std::max(tb, 1e-9) << "\t"
+     << mismatches << "\n";
+
+  ta = Time_nn(kd, points, n, 0.25 * r, a);
+  tb = Time_nn(grid, points, n, 0.25 * r, b);
+  mismatches = 0;
+  for (size_t i = 0; i < n; ++i)
+    mismatches += (a[i] != b[i]);
+  os << "kd\tnn\t" << double(n)/std::max(ta, 1e-9) << "\t0\n";
+  os << "grid\tnn\t" << double(n)/std::max(tb, 1e-9) << "\t"
+     << mismatches << "\n";
+}
+
+int main(int argc, char **argv)
+{
+  std::map<std::string, std::string> options;
+  std::vector<std::string> param;
+  cloudy::misc::get_options (argc, argv, options, param);
+
+  std::string mode = cloudy::misc::to_str(options["mode"], "eps");
+  size_t k = cloudy::misc::to_unsigned(options["k"], 50);
+  double r = cloudy::misc::to_double(options["r"], 0.05);
+  size_t n = cloudy::misc::to_unsigned(options["n"], 0);
+  std::vector<double> epsilons = cloudy::misc::to_doubles(options["eps"]);
+  if (epsilons.empty())
+    {
+      epsilons.push_back(0.1);
+      epsilons.push_back(0.5);
+      epsilons.push_back(1.0);
+      epsilons.push_back(2.0);
+    }
+
+  if (param.size() < 1)
+    {
+      std::cerr << "Usage: " << argv[0] << " file.cloud [-mode eps|index]"
+		<< " [-eps e1,e2,...] [-k k] [-r radius]"
+		<< " [-n number of queries]" << std::endl;
+      return -1;
+    }
+
+  if (mode == "index" && !(r > 0.0))
+    {
+      std::cerr << "The radius should be positive\n";
+      return -1;
+    }
+
+  std::ifstream is(param[0].c_str());
+  cloudy::Data_cloud points;
+  cloudy::load_cloud(is, points);
+  if (points.size() == 0)
+    return -1;
+  if (n == 0 || n > points.size())
+    n = points.size();
+
+  boost::timer t;
+  cloudy::KD_tree kd(points);
+  double tk = t.elapsed();
+
+  if (mode == "eps")
+    Benchmark_eps(points, kd, n, k, r, epsilons, std::cout);
+  else if (mode == "index")
+    Benchmark_index(points, kd, tk, n, r, std::cout);
+  else
+    {
+      std::cerr << "unknown mode " << mode << "\n";
+      return -1;
+    }
+}
@@ -10,7 +10,85 @@
 
 using namespace cloudy;
 
-void Process_all(double r,
+// The graph is read from graph_file when it was built for these
+// points, with this kernel, radius and eps, and is written to it
+// otherwise.
+template <class Index, class Function>
+void Build_graph(const Index &index, const Function &f, double eps,
+		 const std::string &graph_file, cloudy::Neighbor_graph &graph)
+{
+   if (graph_file != "")
+   {
+      std::ifstream is(graph_file.c_str(), std::ios::in | std::ios::binary);
+      if (graph.load(is))
+      {
+	 if (graph.size() == index.size() &&
+	     graph.kernel() == f.name() &&
+	     graph.radius() == f.support_radius() &&
+	     graph.eps() == eps &&
+	     graph.checksum() == cloudy::Neighbor_graph::checksum(index))
+	    return;
+	 std::cerr << "The graph in " << graph_file
+		   << " was built for other data, rebuilding it\n";
+      }
+   }
+
+   std::cerr << "Building neighbour graph... ";
+   boost::timer t;
+   graph.build(index, f, eps);
+   std::cerr << graph.num_edges() << " edges in " << t.elapsed() << "s\n";
+
+   if (graph_file != "")
+   {
+      std::ofstream os(graph_file.c_str(), std::ios::out | std::ios::binary);
+      graph.save(os);
+   }
+}
+
+// Iterated convolutions, or a cached graph, go through a
+// Neighbor_graph; -method is then ignored.
+template <class Function>
+void Convolve_field(const cloudy::Data_cloud &points,
+		    const cloudy::Data_cloud &field,
+		    cloudy::Data_cloud &convolved_field,
+		    const Function &f, double eps, double tol,
+		    const std::string &method, bool grid,
+		    size_t iterations, const std::string &graph_file)
+{
+    if (iterations > 1 || graph_file != "")
+    {
+       cloudy::Neighbor_graph graph;
+       if (grid)
+	  Build_graph(cloudy::Grid_index(points, f.support_radius()),
+		      f, eps, graph_file, graph);
+       else
+	  Build_graph(cloudy::KD_tree(points), f, eps, graph_file, graph);
+       cloudy::convolve_graph<uvector>(graph, field, convolved_field,
+				       iterations);
+    }
+    else if (grid && method == "tree")
+    {
+       cloudy::Grid_index index(points, f.support_radius());
+       cloudy::convolve<uvector>(index, field, convolved_field, f);
+    }
+    else
+    {
+       cloudy::KD_tree kd(points);
+       if (method == "pairs")
+	  cloudy::convolve_pairs<uvector>(kd, field, convolved_field, f);
+       else if (method == "treecode")
+	  cloudy::convolve_tree<uvector>(kd, field, convolved_field, f, tol);
+       else
+	  cloudy::convolve<uvector>(kd, field, convolved_field, f, eps);
+    }
+}
+
+// The kernel is chosen by name here, once: the convolution loops are
+// instantiated for each kernel.
+void Process_all(double r, double eps, double tol,
+		 const std::string &method, bool grid,
+		 size_t iterations, const std::string &graph_file,
+		 const std::string &kernel,
                  std::istream &isCloud,
                  std::istream &isField, 
                  std::ostream &os)
@@ -38,8 +116,31 @@ void Process_all(double r,
        points[i].resize(3);
     }
 
-    cloudy::KD_tree kd(points);
-    cloudy::convolve_uniform<uvector>(kd, field, convolved_field, r);
+    if (kernel == "tent")
+       Convolve_field(points, field, convolved_field,
+		      cloudy::Tent_function(r), eps, tol, method, grid,
+		      iterations, graph_file);
+    else if (kernel == "epanechnikov")
+       Convolve_field(points, field, convolved_field,
+		      cloudy::Epanechnikov_function(r), eps, tol, method, grid,
+		      iterations, graph_file);
+    else if (kernel == "biweight")
+       Convolve_field(points, field, convolved_field,
+		      cloudy::Biweight_function(r), eps, tol, method, grid,
+		      iterations, graph_file);
+    else if (kernel == "gaussian")
+       Convolve_field(points, field, convolved_field,
+		      cloudy::Gaussian_function(r), eps, tol, method, grid,
+		      iterations, graph_file);
+    else if (kernel == "uniform")
+       Convolve_field(points, field, convolved_field,
+		      cloudy::Uniform_function(r), eps, tol, method, grid,
+		      iterations, graph_file);
+    else
+    {
+       std::cerr << "unknown kernel " << kernel << "\n";
+       return;
+    }
 
     write_cloud(os, convolved_field);
 }
@@ -50,23 +151,55 @@ int main(int argc, char **argv)
    std::vector<std::string> param;
    cloudy::misc::get_options (argc, argv, options, param);
    double r = cloudy::misc::to_double(options["r"], 0.05);
+   double eps = cloudy::misc::to_double(options["eps"], 0.0);
+   double tol = cloudy::misc::to_double(options["tol"], 0.0);
+   std::string method = cloudy::misc::to_str(options["method"], "tree");
+   size_t iterations = cloudy::misc::to_unsigned(options["iterations"], 1);
+   std::string graph_file = options["graph"];
+   bool grid = (options["index"] == "grid");
+   std::string kernel = cloudy::misc::to_str(options["kernel"], "uniform");
 
 
    if (param.size() < 2)
    {
-      std::cerr << "Usage: " << argv[0] << " file.cloud file.p [outfile.p -r radius]"
+      std::cerr << "Usage: " << argv[0] << " file.cloud file.p [outfile.p -r radius -eps approximation -method tree|pairs|treecode -tol kernel_tolerance -iterations n -graph file.graph -index kd|grid -kernel uniform|tent|epanechnikov|biweight|gaussian]"
 		<< std::endl;
       return -1;
    }
 
+   if (!(r > 0.0))
+   {
+      std::cerr << "The radius should be positive\n";
+      return -1;
+   }
+
+   // Without a graph, -index grid only serves -method tree (the pairs
+   // bin the points themselves), and the tree code has its own
+   // tolerance and its own tree.
+   if (iterations <= 1 && graph_file == "")
+   {
+      if (method == "treecode" && (eps > 0.0 || grid))
+      {
+	 std::cerr << "-method treecode takes -tol, not -eps or -index grid\n";
+	 return -1;
+      }
+      if (method == "pairs" && grid)
+      {
+	 std::cerr << "-index grid does not apply to -method pairs\n";
+	 return -1;
+      }
+   }
+
    std::ifstream isCloud(param[0].c_str());
    std::ifstream isField(param[1].c_str());
    
    if (param.size() == 3)
    {
       std::ofstream os(param[2].c_str());
-      Process_all(r, isCloud, isField, os);
+      Process_all(r, eps, tol, method, grid, iterations, graph_file, kernel,
+		  isCloud, isField, os);
    }
    else
-      Process_all(r, isCloud, isField, std::cout);
+      Process_all(r, eps, tol, method, grid, iterations, graph_file, kernel,
+		  isCloud, isField, std::cout);
 }
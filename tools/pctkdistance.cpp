@@ -1,83 +1,182 @@
 #include <cloudy/misc/Program_options.hpp>
 #include <cloudy/misc/Progress.hpp>
+#include <cloudy/misc/Morton.hpp>
 #include <cloudy/Cloud.hpp>
 #include <cloudy/KD_tree.hpp>
+#include <cloudy/Distance_to_measure.hpp>
+#include <cloudy/Witnessed_distance.hpp>
 #include <math.h>
 
 #include <boost/timer.hpp>
 #include <fstream>
 #include <vector>
 #include <map>
+#include <algorithm>
 
 using namespace cloudy;
 
-inline
-double squared_norm(const uvector &u)
+// With witness set, the rows are the witnesses of the points for the
+// largest mass (barycenter, then variance), as read by
+// pctwitnessdistance. If D > 0, the points whose search was cut short
+// have no variance and are left out.
+void Evaluate_points(const std::vector<double> &m, double D, double eps,
+		     bool witness,
+		     const cloudy::Data_cloud &points,
+		     const cloudy::KD_tree &kd,
+		     const std::vector<double> &w,
+		     std::ostream &os)
 {
-   return pow(ublas::norm_2(u), 2.0);
+    // Each row of the output (barycenter, then one distance per mass)
+    // is written in place in a flat array, so that the points can be
+    // processed in any order and the result written in input order.
+    const size_t N = points.size();
+    const size_t dim = kd.dim();
+    const size_t cols = dim + (witness ? 1 : m.size());
+    std::vector<double> result(N * cols);
+    std::vector<char> skipped(N, 0);
+
+    cloudy::misc::Progress_display progress(N, std::cerr);
+    boost::timer t;
+
+#pragma omp parallel
+    {
+       cloudy::KD_tree::Nearest_neighbor_iterator nn(kd);
+       cloudy::uvector bary(dim);
+       std::vector<double> h(m.size());
+
+#pragma omp for schedule(dynamic, 256)
+       for (long i = 0; i < long(N); ++i)
+       {
+	  double *row = &result[i * cols];
+	  double squared_radius;
+	  k_distance(m, D, kd, w, points[i], &h.front(), bary, nn,
+		     ANN_DIST_INF, squared_radius, eps);
+	  std::copy(bary.begin(), bary.end(), row);
+	  if (witness && D > 0.0 && h.back() == 10.0)
+	     skipped[i] = 1;
+	  else if (witness)
+	     row[dim] = cloudy::witness(points[i], bary, h.back())[dim];
+	  else
+	     std::copy(h.begin(), h.end(), row + dim);
+
+#pragma omp critical (progress)
+	  ++progress;
+       }
+    }
+    std::cerr << "done in " << t.elapsed() << "s\n";
+
+    const size_t num_skipped = std::count(skipped.begin(), skipped.end(), 1);
+    if (num_skipped > 0)
+       std::cerr << num_skipped << " points beyond D have no witness\n";
+
+    for (size_t i = 0; i < N; ++i)
+    {
+       if (skipped[i])
+	  continue;
+       const double *row = &result[i * cols];
+       for (size_t j = 0; j < cols; ++j)
+	  os << row[j] << " ";
+       os << "\n";
+    }
 }
 
-static const double EPSILON = 1e-6;
-
-double
-k_distance(size_t k, double m, double D,
-           const cloudy::KD_tree &kd, 
-           const std::vector<double> &W,
-           const cloudy::uvector &P,
-           cloudy::uvector &bary)
-{        
-   double totalw = 0.0;
-   double h = 0.0;
-   
-   while(totalw < m - EPSILON)
+// Evaluate the distance function at the vertices of a regular grid
+// of res[0] x res[1] x res[2] samples spanning the box [lo, hi], and
+// write the squared distances as raw float32 values, x varying
+// fastest, one volume after the other for each mass. The slabs of
+// constant z are distributed among the threads; within a slab, the
+// samples are visited in Morton order, so that consecutive queries
+// traverse the same part of the tree. Only a bound is carried over
+// from one sample to the next, not its neighbours: if the mass m was
+// found within radius r around the previous sample q', it lies within
+// r + |q - q'| of the next sample q, which bounds its search.
+void Evaluate_grid(const std::vector<double> &m, double D, double eps,
+		   const cloudy::KD_tree &kd,
+		   const std::vector<double> &w,
+		   const std::vector<double> &lo,
+		   const std::vector<double> &hi,
+		   const std::vector<size_t> &res,
+		   std::ostream &os)
+{
+   const size_t nx = res[0], ny = res[1], nz = res[2];
+   double step[3];
+   for (size_t d = 0; d < 3; ++d)
+      step[d] = (res[d] > 1) ? (hi[d] - lo[d]) / double(res[d] - 1) : 0.0;
+
+   // the Morton codes of the samples of a slab, in increasing order
+   std::vector<boost::uint32_t> codes;
+   codes.reserve(nx * ny);
+   for (boost::uint32_t y = 0; y < ny; ++y)
+      for (boost::uint32_t x = 0; x < nx; ++x)
+	 codes.push_back(cloudy::misc::morton_encode_2(x, y));
+   std::sort(codes.begin(), codes.end());
+
+   const size_t voxels = nx * ny * nz;
+   std::vector<float> volume(voxels * m.size());
+
+   std::cerr << "Sampling on a " << nx << "x" << ny << "x" << nz
+	     << " grid\n";
+   cloudy::misc::Progress_display progress(nz, std::cerr);
+   boost::timer t;
+
+#pragma omp parallel
    {
-      std::vector<size_t> knn;   
-      kd.find_knn(P, k, knn);
-      bary = W[knn[0]]*kd[knn[0]];
-      
-      size_t j = 0;
-      h = 0; totalw = 0;
-      for (; j < k; ++j)
+      cloudy::KD_tree::Nearest_neighbor_iterator nn(kd);
+      cloudy::uvector bary(3), q(3), prev(3);
+      std::vector<double> h(m.size());
+
+#pragma omp for schedule(dynamic, 1)
+      for (long z = 0; z < long(nz); ++z)
       {
-	 double w = W[knn[j]];
-	 
-	 if (totalw + w >= m - EPSILON)
-	    w = m - totalw;
-	 
-	 if (j == 1)
-	    bary = w*kd[knn[j]];
-	 else
-	    bary += w*kd[knn[j]];
-	 h += w*squared_norm(kd[knn[j]] - P);
-	 totalw += w;
-	 //std::cerr << w << "\t" <<  squared_norm(kd[knn[j]] - P) 
-	 //<< "\t" << h << "\n"; 
-	 //std::cerr << ublas::norm_2(kd[knn[j]] - P) << "\n";
-	 
-	 if (totalw >= m - EPSILON)
-	    break;
-      }
+	 double radius = -1.0;	// no seed at the beginning of a slab
+
+	 for (size_t c = 0; c < codes.size(); ++c)
+	 {
+	    boost::uint32_t x, y;
+	    cloudy::misc::morton_decode_2(codes[c], x, y);
+
+	    q[0] = lo[0] + x * step[0];
+	    q[1] = lo[1] + y * step[1];
+	    q[2] = lo[2] + z * step[2];
 
-      h /= totalw;
-      bary /= totalw;
+	    double bound = ANN_DIST_INF;
+	    if (radius >= 0.0)
+	    {
+	       // slightly enlarged, so that rounding never excludes
+	       // the last neighbour of the previous sample
+	       bound = radius + ublas::norm_2(q - prev);
+	       bound = bound * bound * (1.0 + 1e-9) + 1e-12;
+	    }
 
-      // std::cerr << "k = " << j << ", w = " << totalw 
-// 		<< ", D = " << sqrt(h) << "\n";
+	    double squared_radius;
+	    k_distance(m, D, kd, w, q, &h.front(), bary, nn,
+		       bound, squared_radius, eps);
+	    for (size_t j = 0; j < m.size(); ++j)
+	       volume[j * voxels + (z * ny + y) * nx + x] = float(h[j]);
 
-      if (sqrt(h) >= D)
-	 return 10.0;
+	    radius = (squared_radius == ANN_DIST_INF) ?
+	       -1.0 : sqrt(squared_radius);
+	    prev = q;
+	 }
 
-      k *= 2;
+#pragma omp critical (progress)
+	 ++progress;
+      }
    }
-//    std::cerr << "final: " << "w = " << totalw 
-// 	     << ", h = " << h << "\n";
-      
-   //std::cerr << "total w = " << totalw << "\n";
-   return h;
+   std::cerr << "done in " << t.elapsed() << "s\n";
+
+   os.write(reinterpret_cast<const char *>(&volume.front()),
+	    volume.size() * sizeof(float));
 }
 
-void Process_all(size_t k, double m, double D,
+// The grid defaults to the bounding box of the cloud, and a single
+// resolution applies to the three axes. The masses are sorted by
+// increasing value; with uniform weights, the default mass is 1/k.
+void Process_all(size_t k, std::vector<double> m, double D, double eps,
+		 bool witness,
 		 const std::string &weights,
+		 std::vector<double> bbox,
+		 std::vector<double> res,
                  std::istream &isCloud, 
                  std::ostream &os)
 {
@@ -85,7 +184,6 @@ void Process_all(size_t k, double m, double D,
     cloudy::load_cloud(isCloud, points);
 
     cloudy::KD_tree kd(points);
-    cloudy::Data_cloud result;
 
     std::vector<double> w;
     if (weights != "")
@@ -99,27 +197,54 @@ void Process_all(size_t k, double m, double D,
        size_t N = points.size();
        w.resize (N);
        std::fill(w.begin(), w.end(), 1.0/double(N));
-       m = 1.0/double(k);
+       if (m.empty())
+	  m.push_back(1.0/double(k));
        std::cerr << "Processing k-distance" << std::endl;       
     }
-    
-    
-    cloudy::misc::Progress_display progress(points.size(), std::cerr);
-    for (size_t i = 0; i < points.size(); ++i)
+
+    if (m.empty())
     {
-       ++progress;
+       std::cerr << "no mass given (-m m1,m2,...)\n";
+       return;
+    }
+    std::sort(m.begin(), m.end());
 
-       const size_t dimension(points[i].size());
-       cloudy::uvector bary;
-       double h = k_distance(k, m, D, kd, w, points[i], bary);
+    if (res.empty())
+    {
+       Evaluate_points(m, D, eps, witness, points, kd, w, os);
+       return;
+    }
 
-       cloudy::uvector v(bary.size() + 1);
-       std::copy(bary.begin(), bary.end(), v.begin());
-       v[bary.size()] = h;
-       result.push_back(v);
+    if (kd.dim() != 3 || (res.size() != 1 && res.size() != 3) ||
+	(!bbox.empty() && bbox.size() != 6))
+    {
+       std::cerr << "grid mode needs a 3D cloud, -res n or nx,ny,nz and "
+		 << "-bbox xmin,ymin,zmin,xmax,ymax,zmax\n";
+       return;
     }
 
-    write_cloud(os, result);
+    if (bbox.empty())
+    {
+       bbox.resize(6);
+       for (size_t d = 0; d < 3; ++d)
+       {
+	  bbox[d] = bbox[d + 3] = points[0][d];
+	  for (size_t i = 1; i < points.size(); ++i)
+	  {
+	     bbox[d] = std::min(bbox[d], points[i][d]);
+	     bbox[d + 3] = std::max(bbox[d + 3], points[i][d]);
+	  }
+       }
+    }
+    res.resize(3, res[0]);
+
+    std::vector<double> lo(bbox.begin(), bbox.begin() + 3);
+    std::vector<double> hi(bbox.begin() + 3, bbox.end());
+    std::vector<size_t> n(3);
+    for (size_t d = 0; d < 3; ++d)
+       n[d] = std::max(size_t(res[d]), size_t(1));
+
+    Evaluate_grid(m, D, eps, kd, w, lo, hi, n, os);
 }
 
 int main(int argc, char **argv)
@@ -129,20 +254,24 @@ int main(int argc, char **argv)
    cloudy::misc::get_options (argc, argv, options, param);
    std::string weights = cloudy::misc::to_str(options["w"], "");
    size_t k = cloudy::misc::to_unsigned(options["k"], 50);
-   double m = cloudy::misc::to_double(options["m"], 0.0);
+   std::vector<double> m = cloudy::misc::to_doubles(options["m"]);
    double D = cloudy::misc::to_double(options["D"], 0.0);
+   double eps = cloudy::misc::to_double(options["eps"], 0.0);
+   std::vector<double> bbox = cloudy::misc::to_doubles(options["bbox"]);
+   std::vector<double> res = cloudy::misc::to_doubles(options["res"]);
+   bool witness = (options["witness"] == "true");
 
    if (param.size() == 2)
    {
       std::ifstream is(param[0].c_str());
-      std::ofstream os(param[1].c_str());
-      Process_all(k, m, D, weights, is, os);
+      std::ofstream os(param[1].c_str(), std::ios::out | std::ios::binary);
+      Process_all(k, m, D, eps, witness, weights, bbox, res, is, os);
    }
    else if (param.size() == 1)
    {
       std::ifstream is(param[0].c_str());
-      Process_all(k, m, D, weights, is, std::cout);
+      Process_all(k, m, D, eps, witness, weights, bbox, res, is, std::cout);
    }
    else
-     Process_all(k, m, D, weights, std::cin, std::cout);
+     Process_all(k, m, D, eps, witness, weights, bbox, res, std::cin, std::cout);
 }
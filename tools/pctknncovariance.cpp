@@ -0,0 +1,115 @@
+#include <cloudy/misc/Program_options.hpp>
+#include <cloudy/Cloud.hpp>
+#include <cloudy/KD_tree.hpp>
+#include <cloudy/Local_covariance.hpp>
+#include <cloudy/linear/Covariance.hpp>
+
+#include <boost/timer.hpp>
+#include <fstream>
+#include <vector>
+#include <map>
+
+using namespace cloudy;
+
+// Local PCA from the k nearest neighbours of every point, or from its
+// neighbours within each of the radii if some are given. The
+// covariance matrices are written in the .p layout read by
+// pcvcovariance (M11 M12 M13 M22 M23 M33), six columns per radius.
+// Unlike the Voronoi covariance measure, the normal of a PCA
+// covariance is the eigenvector of the *smallest* eigenvalue: if
+// normals_file is given, it receives, for every point, this normal
+// and the surface variation l_min / (l_1 + l_2 + l_3), for the first
+// radius.
+void Process_all(size_t k, const std::vector<double> &radii, double eps,
+		 const std::string &normals_file,
+                 std::istream &isCloud,
+                 std::ostream &os)
+{
+    cloudy::Data_cloud points;
+    cloudy::load_cloud(isCloud, points);
+
+    if (points.size() == 0)
+       return;
+
+    for (size_t i = 0; i < points.size(); ++i)
+       points[i].resize(3, true);
+
+    const size_t n = points.size();
+    cloudy::KD_tree kd(points);
+    std::vector< std::vector<double> > covariances;
+
+    boost::timer t;
+    if (radii.empty())
+    {
+       std::cerr << "Computing covariances of " << k << " neighbours... ";
+       covariances.resize(1);
+       cloudy::knn_covariance(kd, k, covariances[0], eps);
+    }
+    else
+    {
+       std::cerr << "Computing covariances at " << radii.size()
+		 << " radii... ";
+       cloudy::Moment_tree mt(kd);
+       covariances.resize(radii.size());
+       for (size_t j = 0; j < radii.size(); ++j)
+	  cloudy::ball_covariance(mt, radii[j], covariances[j], eps);
+    }
+    std::cerr << "done in " << t.elapsed() << "s\n";
+
+    for (size_t i = 0; i < n; ++i)
+    {
+       for (size_t j = 0; j < covariances.size(); ++j)
+	  for (size_t c = 0; c < 6; ++c)
+	     os << covariances[j][6 * i + c] << " ";
+       os << "\n";
+    }
+
+    if (normals_file == "")
+       return;
+
+    std::vector<double> values, vectors;
+    linear::covariance_diagonalize_3(covariances[0], values, vectors, false);
+
+    std::ofstream normals(normals_file.c_str());
+    for (size_t i = 0; i < n; ++i)
+    {
+       const double sum = values[i] + values[n + i] + values[2 * n + i];
+       normals << vectors[i] << " " << vectors[n + i] << " "
+	       << vectors[2 * n + i] << " "
+	       << (sum > 0.0 ? values[i] / sum : 0.0) << "\n";
+    }
+}
+
+int main(int argc, char **argv)
+{
+   std::map<std::string, std::string> options;
+   std::vector<std::string> param;
+   cloudy::misc::get_options (argc, argv, options, param);
+   size_t k = cloudy::misc::to_unsigned(options["k"], 20);
+   std::vector<double> radii = cloudy::misc::to_doubles(options["r"]);
+   double eps = cloudy::misc::to_double(options["eps"], 0.0);
+   std::string normals_file = options["normals"];
+
+   if (param.size() < 1)
+   {
+      std::cerr << "Usage: " << argv[0] << " file.cloud [outfile.p -k neighbours -r radius[,radius...] -eps approximation -normals normals.p]"
+		<< std::endl;
+      return -1;
+   }
+
+   if (k == 0)
+   {
+      std::cerr << "The number of neighbours should be positive\n";
+      return -1;
+   }
+
+   std::ifstream isCloud(param[0].c_str());
+
+   if (param.size() == 2)
+   {
+      std::ofstream os(param[1].c_str());
+      Process_all(k, radii, eps, normals_file, isCloud, os);
+   }
+   else
+      Process_all(k, radii, eps, normals_file, isCloud, std::cout);
+}
@@ -16,6 +16,7 @@ void Process_all(std::istream &isCloud,
 		 std::istream &isGradient, 
                  std::istream &isOff, 
                  std::ostream &os,
+		 double eps,
 		 size_t comp = 0,
 		 size_t clamp = 3)
 {
@@ -53,7 +54,7 @@ void Process_all(std::istream &isCloud,
     return;
   
   cloudy::KD_tree kd(points);
-  cloudy::Nearest_neighbor_functor<double> f(kd, field);
+  cloudy::Nearest_neighbor_functor<double> f(kd, field, eps);
   
   mesh.simple_colorize(f, ggr, true);
   mesh.write_off(os);
@@ -67,11 +68,12 @@ int main(int argc, char **argv)
 
    size_t clamp = cloudy::misc::to_double(options["tmax"], 3);
    size_t comp = cloudy::misc::to_int(options["comp"], 0);
+   double eps = cloudy::misc::to_double(options["eps"], 0.0);
    
 
    if (param.size() < 2)
    {
-      std::cerr << "Usage: " << argv[0] << " in.cloud in.p file.ggr in.off [out.off] [-comp function component in .p] [-clamp number of position coordinates in .cloud]]"
+      std::cerr << "Usage: " << argv[0] << " in.cloud in.p file.ggr in.off [out.off] [-comp function component in .p] [-clamp number of position coordinates in .cloud] [-eps approximation]]"
 		<< std::endl;
       return -1;
    }
@@ -85,8 +87,8 @@ int main(int argc, char **argv)
    {
      std::cerr << "outputing in " << param[4] << "\n";
       std::ofstream os(param[4].c_str());
-      Process_all(isCloud, isField, isGradient, isOff, os, comp, clamp);
+      Process_all(isCloud, isField, isGradient, isOff, os, eps, comp, clamp);
    }
    else
-     Process_all(isCloud, isField, isGradient, isOff, std::cout, comp, clamp);
+     Process_all(isCloud, isField, isGradient, isOff, std::cout, eps, comp, clamp);
 }
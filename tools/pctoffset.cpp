@@ -63,14 +63,6 @@ void Build_regular_triangulation(std::istream &is, RT &rt,
 }
 
 
-std::ostream &
-operator << (std::ostream &os, const cloudy::offset::Covariance_vector &cov)
-{
-   for (size_t i = 0; i < cov.size(); ++i)
-      os << cov[i] << " ";
-   return os;
-}
-
 template <class Subdivider, class Integrator, class RT,
           class Iterator>
 void
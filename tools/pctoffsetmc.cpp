@@ -2,6 +2,7 @@
 #include <cloudy/misc/Progress.hpp>
 #include <cloudy/random/Random.hpp>
 #include <cloudy/KD_tree.hpp>
+#include <cloudy/Grid_index.hpp>
 
 #include <boost/timer.hpp>
 #include <fstream>
@@ -17,6 +18,19 @@ enum Integration_type
     COVARIANCE
   };
 
+enum Estimator_type
+  {
+    ESTIMATOR_BALLS,
+    ESTIMATOR_UNION
+  };
+
+enum Sampler_type
+  {
+    SAMPLER_RANDOM,
+    SAMPLER_SOBOL,
+    SAMPLER_STRATIFIED
+  };
+
 std::ostream &
 operator << (std::ostream &os, const cloudy::uvector &cov)
 {
@@ -60,148 +74,415 @@ void Load_data(std::istream &is, cloudy::Data_cloud &points)
       points[i] = three_to_four(points[i]);
 }
 
-#ifdef OFF_CURVATURE
-
-#include "cumulative.hpp"
-
+// Curvature measures of the offset: the cumulative function F(r) of
+// the sampled volume of each Voronoi cell, as a function of the
+// distance r to the cell's point, is fitted by c0 + c1 r + c2 r^2 in
+// the least-squares sense over [0, R]. Writing t = r/R, the normal
+// equations involve the 3x3 Hilbert matrix and the right-hand sides
+//   int_0^1 t^a F(R t) dt = sum_l w_l (1 - t_l^(a+1))/(a+1),
+// so that it is enough to accumulate sum w t^a for a = 0..3 for each
+// point, in constant memory.
 class MC_curvature_measures_integrator
 {
-  const cloudy::KD_tree &_kd;
-  std::vector< std::vector<double> > _radii;
-  std::vector< std::vector<double> > _weights;
+  std::vector<double> _moments;
+  std::vector<size_t> _counts;
+  double _R;
   double _total_value;
 
 public:
-  MC_curvature_measures_integrator(const cloudy::KD_tree &kd): _kd(kd)
+  template <class Index>
+  MC_curvature_measures_integrator(const Index &kd, double R):
+    _moments(4 * kd.size(), 0.0),
+    _counts(kd.size(), 0),
+    _R(R),
+    _total_value(0.0)
+  {}
+
+  void operator () (size_t nn, double squared_distance, double value)
   {
-    _radii.resize(kd.size());
-    _weights.resize(kd.size());
-    _total_value = 0.0;
+    double t = std::min(sqrt(squared_distance)/_R, 1.0);
+    double *m = &_moments[4 * nn];
+
+#pragma omp atomic
+    m[0] += value;
+#pragma omp atomic
+    m[1] += value * t;
+#pragma omp atomic
+    m[2] += value * t * t;
+#pragma omp atomic
+    m[3] += value * t * t * t;
+#pragma omp atomic
+    _counts[nn]++;
   }
-  void operator () (const cloudy::uvector &pos, double value)
-  {
-    size_t nn = _kd.find_nn(three_to_four(pos));
-    double rad = cloudy::ublas::norm_2(_kd[nn] - pos);
 
-    _radii[nn].push_back(rad);
-    _weights[nn].push_back(value);
-    _total_value += value;
+  void finish()
+  {
+    _total_value = 0.0;
+    for (size_t i = 0; i < _counts.size(); ++i)
+      _total_value += _moments[4 * i];
   }
 
-  cloudy::uvector result(size_t i)
+  cloudy::uvector result(size_t i) const
   {
     assert(_total_value > 0);
 
-    if (_radii[i].size() < 3)
+    if (_counts[i] < 3)
 	return cloudy::ublas::zero_vector<double>(3);
-    
-    std::vector<double> radii, values;
-    cumulative_function(_radii[i], _weights[i], 
-			radii, values);
-
-    for (size_t s = 0; s < _weights[i].size(); ++s)
-      values[s] /= _total_value;
-    
-    double c0, c1, c2;
-    linear_fit_quadratic(radii, values, c0, c1, c2);
+
+    const double *m = &_moments[4 * i];
+    double b[3];
+    b[0] = (m[0] - m[1]) / _total_value;
+    b[1] = (m[0] - m[2]) / (2.0 * _total_value);
+    b[2] = (m[0] - m[3]) / (3.0 * _total_value);
+
+    // inverse of the 3x3 Hilbert matrix
+    static const double Hinv[3][3] = {{  9.0,  -36.0,   30.0},
+				      {-36.0,  192.0, -180.0},
+				      { 30.0, -180.0,  180.0}};
     cloudy::uvector res(3);
-    res[0] = c0; res[1] = c1; res[2] = c2;
+    for (size_t a = 0; a < 3; ++a)
+      res[a] = Hinv[a][0] * b[0] + Hinv[a][1] * b[1] + Hinv[a][2] * b[2];
 
+    // back from t to r
+    res[1] /= _R;
+    res[2] /= _R * _R;
     return res;
   }
 };
 
-#endif
-
 class MC_volume_integrator
 {
-  const cloudy::KD_tree &_kd;
   std::vector<double> _results;
   double _total_value;
 
 public:
-  MC_volume_integrator(const cloudy::KD_tree &kd): _kd(kd)
+  template <class Index>
+  MC_volume_integrator(const Index &kd, double):
+    _results(kd.size(), 0.0),
+    _total_value(0.0)
+  {}
+
+  void operator () (size_t nn, double, double value)
   {
-    _results.resize(kd.size(), 0);
-    _total_value = 0.0;
+#pragma omp atomic
+    _results[nn] += value;
   }
 
-  void operator () (const cloudy::uvector &pos, double value)
+  void finish()
   {
-    size_t nn = _kd.find_nn(three_to_four(pos));
-    _results[nn] += value;
-    _total_value += value;
+    _total_value = 0.0;
+    for (size_t i = 0; i < _results.size(); ++i)
+      _total_value += _results[i];
   }
 
-  double result(size_t i)
+  double result(size_t i) const
   {
     assert(_total_value > 0);
     return _results[i]/_total_value;
   }
 };
 
-template <class MC_integrator>
+// The integration loops below run in parallel over the points. Every
+// point (or chunk of samples) uses its own random engine seeded by its
+// index, so that results do not depend on the number of threads.
+
+template <class MC_integrator, class Sampler, class Index>
 void
-Batch_integrate(const cloudy::KD_tree &kd, double R, 
-		size_t N, std::ostream &os)
+Batch_integrate(const Index &kd, double R, double eps,
+		size_t N, std::ostream &os, const Sampler &randball)
 {
-  MC_integrator ig (kd);
+  MC_integrator ig (kd, R);
 
   std::cerr << "Integrating... \n";
   cloudy::misc::Progress_display progress(kd.size(), std::cerr);
   boost::timer t;
 
-  cloudy::random::Random_vector_in_ball<cloudy::uvector> randball (3, R);
-  boost::mt19937 engine;
+#pragma omp parallel
+  {
+    Sampler sampler (randball);
+
+#pragma omp for schedule(dynamic, 64)
+    for (long i = 0; i < long(kd.size()); ++i)
+      {
+	boost::mt19937 engine (i);
+	cloudy::uvector p_0 = four_to_three(kd[i]);
+	sampler.restart(engine);
+
+	for (size_t j = 0; j < N; ++j)
+	  {
+	    cloudy::uvector p = three_to_four(p_0 + sampler(engine));
+	    size_t nn; double sqd;
+	    size_t k = kd.count_points_in_ball(p, R, nn, sqd, eps);
+	    if (k <= 0) continue;
+
+	    ig(nn, sqd, 1.0/double(k));
+	  }
+#pragma omp critical (progress)
+	++progress;
+      }
+  }
+  ig.finish();
+  
+  std::cerr << "Computing and writing\n";
+  for (size_t i = 0; i < kd.size(); ++i)
+    os << ig.result(i) << std::endl;
+
+  std::cerr << "done in " << t.elapsed() << "s\n";
+}
 
+struct MC_sample
+{
+  size_t nn;
+  double squared_distance;
+  double value;
+};
+
+// Same estimator as Batch_integrate, but the samples of each ball are
+// drawn by batches until the standard error of the mean sample value,
+// tracked with Welford's algorithm, falls below tol times the mean,
+// or N samples have been drawn. The samples of a ball are scaled by
+// N/n so that every ball keeps the weight of N samples. Besides the
+// result, line i reports the relative sampling error reached in the
+// ball around point i and the number of samples drawn in it. This is
+// the error on the mean 1/k weight of these samples, i.e. on the
+// share of the ball in the volume of the union, which drives the
+// stopping rule; it does not bound the error of the result of point
+// i, whose Voronoi cell also receives samples drawn in neighbouring
+// balls. The error is that of independent samples, so only the random
+// sampler may be used.
+template <class MC_integrator, class Sampler, class Index>
+void
+Adaptive_integrate(const Index &kd, double R, double eps,
+		   size_t N, double tol, size_t batch,
+		   std::ostream &os, const Sampler &randball)
+{
+  MC_integrator ig (kd, R);
+  std::vector<double> errors(kd.size());
+  std::vector<size_t> counts(kd.size());
+  size_t total = 0;
+
+  batch = std::max(batch, size_t(1));
+
+  std::cerr << "Integrating... \n";
+  cloudy::misc::Progress_display progress(kd.size(), std::cerr);
+  boost::timer t;
+
+#pragma omp parallel reduction(+:total)
+  {
+    Sampler sampler (randball);
+    std::vector<MC_sample> samples;
+    samples.reserve(N);
+
+#pragma omp for schedule(dynamic, 64)
+    for (long i = 0; i < long(kd.size()); ++i)
+      {
+	boost::mt19937 engine (i);
+	cloudy::uvector p_0 = four_to_three(kd[i]);
+	sampler.restart(engine);
+	samples.clear();
+
+	size_t n = 0;
+	double mean = 0.0, M2 = 0.0;
+	while (n < N)
+	  {
+	    size_t end = std::min(n + batch, N);
+	    for (; n < end; ++n)
+	      {
+		cloudy::uvector p = three_to_four(p_0 + sampler(engine));
+		MC_sample s;
+		size_t k = kd.count_points_in_ball(p, R, s.nn, 
+						   s.squared_distance, eps);
+		s.value = (k > 0) ? 1.0/double(k) : 0.0;
+		if (k > 0)
+		  samples.push_back(s);
+
+		double delta = s.value - mean;
+		mean += delta/double(n + 1);
+		M2 += delta * (s.value - mean);
+	      }
+
+	    // require two batches before trusting the variance
+	    if (n >= 2 * batch && 
+		sqrt(M2/double(n - 1)/double(n)) <= tol * mean)
+	      break;
+	  }
+
+	double scale = double(N)/double(n);
+	for (size_t j = 0; j < samples.size(); ++j)
+	  ig(samples[j].nn, samples[j].squared_distance, 
+	     scale * samples[j].value);
+
+	errors[i] = (mean > 0.0 && n > 1) ? 
+	  sqrt(M2/double(n - 1)/double(n))/mean : 0.0;
+	counts[i] = n;
+	total += n;
+#pragma omp critical (progress)
+	++progress;
+      }
+  }
+  ig.finish();
+  std::cerr << "used " << total << " samples, " 
+	    << 100.0 * double(total)/(double(N) * double(kd.size()))
+	    << "% of the non-adaptive count\n";
+  
+  std::cerr << "Computing and writing\n";
   for (size_t i = 0; i < kd.size(); ++i)
-    {
-      cloudy::uvector p_0 = four_to_three(kd[i]);
+    os << ig.result(i) << " " << errors[i] << " " << counts[i] << std::endl;
+
+  std::cerr << "done in " << t.elapsed() << "s\n";
+}
+
+// Sample the union of the balls uniformly once instead of sampling
+// every ball and down-weighting the overlaps: candidates are drawn in
+// a voxel cover of the union and rejected when no point lies within
+// R. N is understood as a number of samples per ball volume, so that
+// an isolated point gets the same number of samples as in
+// Batch_integrate while the total work scales with the offset volume.
+template <class MC_integrator, class Index>
+void
+Union_integrate(const Index &kd, double R, double eps,
+		size_t N, std::ostream &os)
+{
+  MC_integrator ig (kd, R);
+
+  std::cerr << "Building voxel cover... ";
+  boost::timer t;
+  cloudy::Data_cloud centers(kd.size());
+  for (size_t i = 0; i < kd.size(); ++i)
+    centers[i] = four_to_three(kd[i]);
+
+  const cloudy::random::Random_point_in_voxel_cover<cloudy::uvector> 
+    randcover(centers, R);
+  const double ball_volume = 4.0/3.0 * M_PI * R * R * R;
+  const size_t trials = size_t(N * randcover.volume()/ball_volume);
+  std::cerr << randcover.num_voxels() << " voxels, "
+	    << trials << " samples\n";
 
-      for (size_t j = 0; j < N; ++j)
+  std::cerr << "Integrating... \n";
+  cloudy::misc::Progress_display progress(kd.size(), std::cerr);
+  size_t accepted = 0;
+
+#pragma omp parallel for schedule(dynamic, 64) reduction(+:accepted)
+  for (long i = 0; i < long(kd.size()); ++i)
+    {
+      boost::mt19937 engine (i);
+      size_t end = (trials * (i + 1))/kd.size();
+      for (size_t j = (trials * i)/kd.size(); j < end; ++j)
 	{
-	  cloudy::uvector p = three_to_four(p_0 + randball(engine));
-	  size_t k = kd.count_points_in_ball(p, R);
-	  if (k <= 0) continue;
+	  cloudy::uvector p = three_to_four(randcover(engine));
+	  size_t nn; double sqd;
+	  if (kd.count_points_in_ball(p, R, nn, sqd, eps) == 0) 
+	    continue;
 
-	  ig(p, 1.0/double(k));
+	  ig(nn, sqd, 1.0);
+	  ++accepted;
 	}
+#pragma omp critical (progress)
       ++progress;
     }
+  ig.finish();
+  std::cerr << "acceptance rate: " << double(accepted)/double(trials) 
+	    << "\n";
   
   std::cerr << "Computing and writing\n";
-  cloudy::misc::Progress_display progress2(kd.size(), std::cerr);
   for (size_t i = 0; i < kd.size(); ++i)
-    {
-      os << ig.result(i) << std::endl;
-      ++progress;
-    }
+    os << ig.result(i) << std::endl;
 
   std::cerr << "done in " << t.elapsed() << "s\n";
 }
 
 
-void Process_all(std::istream &is,  std::ostream &os, 
-		 Integration_type type,
-                 double R, size_t N)
+template <class MC_integrator, class Sampler, class Index>
+void
+Integrate_balls(const Index &kd, double R, double eps, size_t N,
+		double tol, size_t batch,
+		std::ostream &os, const Sampler &randball)
 {
-   cloudy::Data_cloud points;
-   Load_data(is, points);   
-   cloudy::KD_tree kd(points);
+  if (tol > 0.0)
+    Adaptive_integrate<MC_integrator> (kd, R, eps, N, tol, batch, os, randball);
+  else
+    Batch_integrate<MC_integrator> (kd, R, eps, N, os, randball);
+}
+
+template <class MC_integrator, class Index>
+void
+Integrate(const Index &kd, Estimator_type estimator,
+	  Sampler_type sampler, double R, double eps, size_t N, 
+	  double tol, size_t batch, std::ostream &os)
+{
+  using namespace cloudy::random;
+
+  if (estimator == ESTIMATOR_UNION)
+    {
+      if (tol > 0.0)
+	std::cerr << "-tol is ignored by the union estimator\n";
+      Union_integrate<MC_integrator> (kd, R, eps, N, os);
+      return;
+    }
 
+  switch (sampler)
+    {
+    case SAMPLER_SOBOL:
+      Integrate_balls<MC_integrator> 
+	(kd, R, eps, N, tol, batch, os, Sobol_vector_in_ball<cloudy::uvector> (3, R));
+      break;
+
+    case SAMPLER_STRATIFIED:
+      Integrate_balls<MC_integrator> 
+	(kd, R, eps, N, tol, batch, os, 
+	 Stratified_vector_in_ball<cloudy::uvector> (3, R, N));
+      break;
+
+    default:
+      Integrate_balls<MC_integrator> 
+	(kd, R, eps, N, tol, batch, os, Random_vector_in_ball<cloudy::uvector> (3, R));
+      break;
+    }
+}
+
+template <class Index>
+void Process_index(const Index &kd, std::ostream &os, 
+		   Integration_type type, Estimator_type estimator,
+		   Sampler_type sampler, double R, double eps, size_t N,
+		   double tol, size_t batch)
+{
    std::cerr << "type = " << type << "\n";
    switch (type)
      {
      case VOLUME:
        std::cerr << "type = " << type << "\n";
-       Batch_integrate<MC_volume_integrator> (kd, R, N, os);
+       Integrate<MC_volume_integrator> 
+	 (kd, estimator, sampler, R, eps, N, tol, batch, os);
        break;
 
-#ifdef OFF_CURVATURE
      case CURVATURE:
-       Batch_integrate<MC_curvature_measures_integrator> (kd, R, N, os);
+       Integrate<MC_curvature_measures_integrator> 
+	 (kd, estimator, sampler, R, eps, N, tol, batch, os);
        break;
-#endif
+     }
+}
+
+// The ball queries run either on a kd-tree, or on a grid of cells of
+// size R, which suits the fixed radius of all the queries.
+void Process_all(std::istream &is,  std::ostream &os, 
+		 Integration_type type, Estimator_type estimator,
+		 Sampler_type sampler, double R, double eps, size_t N,
+		 double tol, size_t batch, bool grid)
+{
+   cloudy::Data_cloud points;
+   Load_data(is, points);   
+
+   if (grid)
+     {
+       cloudy::Grid_index index(points, R);
+       Process_index(index, os, type, estimator, sampler, R, eps, N,
+		     tol, batch);
+     }
+   else
+     {
+       cloudy::KD_tree kd(points);
+       Process_index(kd, os, type, estimator, sampler, R, eps, N,
+		     tol, batch);
      }
 }
 
@@ -216,21 +497,48 @@ int main(int argc, char **argv)
      type = COVARIANCE;
    else if (options["type"] == "curvature")
      type = CURVATURE;
+
+   Estimator_type estimator = ESTIMATOR_BALLS;
+   if (options["estimator"] == "union")
+     estimator = ESTIMATOR_UNION;
+
+   Sampler_type sampler = SAMPLER_RANDOM;
+   if (options["sampler"] == "sobol")
+     sampler = SAMPLER_SOBOL;
+   else if (options["sampler"] == "stratified")
+     sampler = SAMPLER_STRATIFIED;
      
    double R = cloudy::misc::to_double(options["R"], 0.1);
    size_t N = cloudy::misc::to_unsigned(options["N"], 100);
+   double tol = cloudy::misc::to_double(options["tol"], 0.0);
+   double eps = cloudy::misc::to_double(options["eps"], 0.0);
+   bool grid = (options["index"] == "grid");
+   size_t batch = cloudy::misc::to_unsigned(options["batch"], 16);
+
+   if (!(R > 0.0))
+   {
+      std::cerr << "The radius should be positive" << std::endl;
+      return -1;
+   }
+
+   if (tol > 0.0 && sampler != SAMPLER_RANDOM)
+   {
+      std::cerr << "-tol requires independent samples (-sampler random)"
+		<< std::endl;
+      return -1;
+   }
 
    if (param.size() == 1)
    {
       std::ifstream is(param[0].c_str());
-      Process_all(is, std::cout, type, R, N);
+      Process_all(is, std::cout, type, estimator, sampler, R, eps, N, tol, batch, grid);
    }
    else if (param.size() == 2)
    {
       std::ifstream is(param[0].c_str());
       std::ofstream os(param[1].c_str());
-      Process_all(is, os, type, R, N);
+      Process_all(is, os, type, estimator, sampler, R, eps, N, tol, batch, grid);
    }
    else
-      Process_all(std::cin, std::cout, type, R, N);
+      Process_all(std::cin, std::cout, type, estimator, sampler, R, eps, N, tol, batch, grid);
 }
@@ -0,0 +1,81 @@
+#include <cloudy/misc/Program_options.hpp>
+#include <cloudy/misc/Progress.hpp>
+#include <cloudy/Cloud.hpp>
+#include <cloudy/Witnessed_distance.hpp>
+
+#include <boost/timer.hpp>
+#include <fstream>
+#include <vector>
+#include <map>
+
+using namespace cloudy;
+
+// Evaluate the witnessed distance to a measure at the query points.
+// The witnesses are computed by pctkdistance +witness; the squared
+// distances are written one per line, in the order of the queries,
+// and lie between d^2 and 9 d^2, d being the distance to the measure.
+void Process_all(std::istream &isWitnesses,
+                 std::istream &isQueries,
+                 std::ostream &os)
+{
+    cloudy::Data_cloud witnesses, queries;
+    cloudy::load_cloud(isWitnesses, witnesses);
+    cloudy::load_cloud(isQueries, queries);
+
+    if (witnesses.size() == 0)
+       return;
+
+    std::cerr << "Indexing " << witnesses.size() << " witnesses\n";
+    cloudy::Witnessed_distance dw(witnesses);
+
+    const size_t N = queries.size();
+    std::vector<double> result(N);
+
+    cloudy::misc::Progress_display progress(N, std::cerr);
+    boost::timer t;
+
+#pragma omp parallel
+    {
+       cloudy::KD_tree::Nearest_neighbor_iterator nn(dw.tree());
+       cloudy::uvector query(dw.dim() + 1);
+
+#pragma omp for schedule(dynamic, 256)
+       for (long i = 0; i < long(N); ++i)
+       {
+	  queries[i].resize(dw.dim(), true);
+	  result[i] = dw.squared_distance(queries[i], nn, query);
+
+#pragma omp critical (progress)
+	  ++progress;
+       }
+    }
+    std::cerr << "done in " << t.elapsed() << "s\n";
+
+    for (size_t i = 0; i < N; ++i)
+       os << result[i] << "\n";
+}
+
+int main(int argc, char **argv)
+{
+   std::map<std::string, std::string> options;
+   std::vector<std::string> param;
+   cloudy::misc::get_options (argc, argv, options, param);
+
+   if (param.size() < 2)
+   {
+      std::cerr << "Usage: " << argv[0]
+		<< " witnesses.cloud queries.cloud [outfile.p]" << std::endl;
+      return -1;
+   }
+
+   std::ifstream isWitnesses(param[0].c_str());
+   std::ifstream isQueries(param[1].c_str());
+
+   if (param.size() == 3)
+   {
+      std::ofstream os(param[2].c_str());
+      Process_all(isWitnesses, isQueries, os);
+   }
+   else
+      Process_all(isWitnesses, isQueries, std::cout);
+}
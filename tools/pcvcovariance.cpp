@@ -1,5 +1,4 @@
 #include <cloudy/linear/Covariance.hpp>
-#include <cloudy/misc/Progress.hpp>
 #include "pctviewer.hpp"
 #include <fstream>
 
@@ -59,22 +58,7 @@ bool setup(cloudy::view::Viewer &w,
    Data_cloud_ptr K2 (new Data_cloud());
    Scalar_field_ptr anisotropy (new Scalar_field());
 
-   cloudy::misc::Progress_display progress(cloud->size(), std::cerr);
-
-   for (Data_cloud::iterator it = covariance->begin();
-	it != covariance->end(); ++it)
-   {
-      std::vector<double> V;
-      std::vector<uvector> D;
-
-      covariance_extract_eigen(matrix_from_covariance_3(*it), V, D);
-      covariance_sort_eigen(V, D);
-      normals->push_back(D[0]);
-      K1->push_back(D[1]);
-      K2->push_back(D[2]);
-      anisotropy->push_back(V[1]/(V[0] + V[1] + V[2]));
-      ++progress;
-   }
+   covariance_diagonalize_3(*covariance, *normals, *K1, *K2, *anisotropy);
    std::cerr << "done\n";
    
    Cloud_drawer *c = new Cloud_drawer("Cloud", cloud, anisotropy);